@@ -0,0 +1,88 @@
+// NOTE: README.md contains summary docs
+
+#ifndef ALARM_THRESHOLD_HPP
+#define ALARM_THRESHOLD_HPP
+
+#include <cstdint>
+#include <stdexcept>
+
+// To intern: integer ceil(windowSize * alarmPercentage / 100). The floating
+// point version (ceil(windowSize * (alarmPercentage / 100.0))) rounds the
+// wrong way for percentages that are not exact in binary, e.g. 100 * 0.07 is
+// 7.000000000000001 and would demand 8 peaks instead of 7.
+constexpr unsigned int minimumPeaksFor(unsigned int windowSize,
+                                       unsigned int alarmPercentage) {
+  std::uint64_t scaled = std::uint64_t(windowSize) * alarmPercentage;
+  return (unsigned int)((scaled + 99) / 100);
+}
+
+// Alarm configuration picked at runtime. The threshold is derived once in the
+// constructor instead of on every sample.
+class RuntimeThreshold {
+private:
+  unsigned int windowSizeValue;
+  unsigned int alarmPercentageValue;
+  unsigned int minimumPeaksValue;
+
+public:
+  static const bool is_static = false;
+
+  unsigned int windowSize() const {return windowSizeValue;}
+  unsigned int alarmPercentage() const {return alarmPercentageValue;}
+  unsigned int minimumPeaks() const {return minimumPeaksValue;}
+
+  // Checkpoint support: the configuration is stored so a checkpoint is
+  // never restored into a detector configured differently.
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(windowSizeValue);
+    out.put(alarmPercentageValue);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) const {
+    in.expect(windowSizeValue, "window size");
+    in.expect(alarmPercentageValue, "alarm percentage");
+  }
+
+  // Note: every runtime configured detector builds one of these, so this is
+  // where a window of 0 (which no window storage can hold) is turned away.
+  RuntimeThreshold(unsigned int windowSize, unsigned int alarmPercentage)
+    : windowSizeValue(windowSize),
+      alarmPercentageValue(alarmPercentage),
+      minimumPeaksValue(minimumPeaksFor(windowSize, alarmPercentage)) {
+    if (windowSize == 0) {
+      throw std::invalid_argument("window size must be at least 1");
+    }
+  }
+};
+
+// Alarm configuration fixed at compile time, so every comparison against the
+// threshold is against an immediate.
+template <unsigned int WindowSize, unsigned int AlarmPercentage>
+class StaticThreshold {
+public:
+  static_assert(WindowSize > 0, "window must hold at least one sample");
+
+  static const bool is_static = true;
+
+  static constexpr unsigned int windowSize() {return WindowSize;}
+  static constexpr unsigned int alarmPercentage() {return AlarmPercentage;}
+  static constexpr unsigned int minimumPeaks() {
+    return minimumPeaksFor(WindowSize, AlarmPercentage);
+  }
+
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(WindowSize);
+    out.put(AlarmPercentage);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) const {
+    in.expect(WindowSize, "window size");
+    in.expect(AlarmPercentage, "alarm percentage");
+  }
+};
+
+#endif
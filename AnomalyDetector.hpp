@@ -0,0 +1,492 @@
+// NOTE: README.md contains summary docs
+
+#ifndef ANOMALY_DETECTOR_HPP
+#define ANOMALY_DETECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "AlarmThreshold.hpp"
+#include "Instrumentation.hpp"
+#include "PeakHistory.hpp"
+#include "PeakKernel.hpp"
+#include "PeakPolicy.hpp"
+#include "PeakWindow.hpp"
+
+// To intern: we define defaults here to make the code reusable/generalizable
+namespace defaults
+{
+    static const unsigned int window_size = 100;
+    static const unsigned int alarm_percentage = 25;
+}
+
+// One continuous stretch of samples during which the alarm was active.
+// Sample numbers count from 0 over everything the detector has consumed.
+struct AlarmEpisode {
+  std::uint64_t start;       // first sample in alarm
+  std::uint64_t end;         // one past the last sample in alarm
+  std::size_t minPeakCount;  // fewest peaks in the window during the episode
+
+  bool operator==(const AlarmEpisode&) const = default;
+};
+
+// Caller buffer for the window's peak count as the batch calls go, e.g. to
+// watch a channel approach its threshold. The count after every `every`th
+// sample (numbered like AlarmEpisode, so decimation does not depend on how
+// the stream is cut into batches) is written to values[written++]: as is
+// for an integral Value, as a percentage of the window size for a floating
+// point one. Reset written once the values have been used.
+template <typename Value>
+struct PeakTrace {
+  std::span<Value> values;
+  unsigned int every = 1;
+  std::size_t written = 0;
+};
+
+// To intern: Class instead of namespace for reusabiltiy
+// Note: the window storage, the alarm threshold and the peak definition are
+// template parameters (see PeakWindow.hpp, AlarmThreshold.hpp and
+// PeakPolicy.hpp) so the per-sample path has no virtual calls.
+// AnomalyDetector below keeps the original deque of peak indices,
+// RingAnomalyDetector uses a bit ring and StaticAnomalyDetector fixes the
+// window and percentage at compile time. The sample type comes from the peak
+// policy (int unless e.g. BasicStrictPeakPolicy<float>, see
+// TypedAnomalyDetector) and Counter is the width of the sample counter.
+// To intern: the counter is 64 bits by default. At tens of millions of
+// samples a second a 32 bit counter wraps within minutes, and every wrap
+// renumbers the window (O(window) for the deque); a 64 bit one never does.
+template <typename PeakWindow, typename Threshold = RuntimeThreshold,
+          typename PeakPolicy = StrictPeakPolicy,
+          typename Counter = std::uint64_t>
+class BasicAnomalyDetector {
+public:
+  using Sample = typename PeakPolicy::Sample;
+
+private:
+  PeakPolicy peaks;
+  Counter datumNum = 0;
+  bool overflowOccured = false;
+  bool alarmActive = false;
+  bool slackSkipping = true;
+  std::uint64_t samplesConsumed = 0;
+  AlarmEpisode openEpisode = {};
+  PeakHistory* history = nullptr;
+
+  PeakWindow window;
+  Threshold threshold;
+
+  void incrementDatumNum(){
+    // To intern: resetting all time step vals but keeping relative order
+    if (datumNum == std::numeric_limits<Counter>::max()){
+      overflowOccured = true;
+
+      Counter offset = std::numeric_limits<Counter>::max() -
+                       threshold.windowSize();
+
+      // modifying datanum itself. Subtracting 1 more because next line adds 1
+      datumNum -= (offset + 1);
+      // modifying all recent peaks by the same amount, so they keep their
+      // distance to datumNum (no-op for windows that do not store absolute
+      // sample numbers)
+      window.rebase(offset + 1);
+    }
+
+    datumNum++;
+  }
+
+  // To intern: deriving minimumPeaks (see AlarmThreshold.hpp) is good for
+  // reusability/generalization. Also we check minDataReceived because we need
+  // to have enough datapoints before checking if there is an anomaly.
+  void checkForAnomaly() {
+    bool peaksBelowThreshold = window.peakCount() < threshold.minimumPeaks();
+    bool minDataReceived = datumNum >= threshold.windowSize();
+
+    alarmActive = minDataReceived && peaksBelowThreshold;
+  }
+
+  // How many more samples are certain not to raise the alarm. Every sample
+  // lowers the peak count by at most one, so with slack = peaks - minimum
+  // the next slack samples cannot take it below the threshold, and nothing
+  // alarms before the window has filled. Capped so skipping never has to
+  // deal with datumNum wrapping.
+  std::size_t samplesWithoutAlarm() const {
+    if (alarmActive) return 0;
+    std::size_t peakCount = window.peakCount();
+    std::size_t minimum = threshold.minimumPeaks();
+    std::size_t slack = peakCount > minimum ? peakCount - minimum : 0;
+    std::size_t warmup = datumNum + std::size_t(1) < threshold.windowSize()
+      ? threshold.windowSize() - 1 - datumNum
+      : 0;
+    std::size_t safe = slack > warmup ? slack : warmup;
+    std::uint64_t left = std::numeric_limits<Counter>::max() - datumNum;
+    return safe < left ? safe : (std::size_t)left;
+  }
+
+  // Takes count samples (peak bits first.. of a block) with no alarm
+  // checks. Only valid for count <= samplesWithoutAlarm().
+  void skipAhead(const std::uint64_t* peakBits, std::size_t first,
+                 std::size_t count) {
+    if constexpr (requires {window.slideBlock(peakBits, first, count);}) {
+      window.slideBlock(peakBits, first, count);
+      datumNum += count;
+    } else {
+      for (std::size_t i = first; i < first + count; i++) {
+        datumNum++;
+        window.slide(datumNum, (peakBits[i / 64] >> (i % 64)) & 1);
+      }
+    }
+  }
+
+  // Runs the peak policy over data a block at a time (SIMD for the strict
+  // policy) and calls perSample(index, isPeak) for every sample in order.
+  // perSample returns true to stop after that sample. Leaves the peak state
+  // as if the consumed samples had gone through processNewDataPoint and
+  // returns how many samples were consumed.
+  // Note: with slack skipping on, runs of samples that cannot change the
+  // alarm state go through skipAhead instead, and perSample only sees
+  // onSkip(peakBits, first, count) for them.
+  // skipLimit(index) caps a run starting at data[index], e.g. so it stops
+  // short of a sample that has to be seen.
+  template <typename PerSample, typename OnSkip, typename SkipLimit>
+  std::size_t forEachSample(std::span<const Sample> data,
+                            PerSample&& perSample, OnSkip&& onSkip,
+                            SkipLimit&& skipLimit) {
+    // shorter runs are not worth leaving the per-sample loop for
+    const std::size_t min_skip = 8;
+    std::uint64_t peakBits[peak_kernel::block_words];
+    std::size_t consumed = data.size();
+
+    for (std::size_t base = 0; base < data.size();
+         base += peak_kernel::block_size) {
+      const Sample* block = data.data() + base;
+      std::size_t count = data.size() - base < peak_kernel::block_size
+        ? data.size() - base
+        : peak_kernel::block_size;
+      peaks.findPeaks(block, count, peakBits);
+
+      std::size_t i = 0;
+      while (i < count) {
+        std::size_t safe = slackSkipping ? samplesWithoutAlarm() : 0;
+        std::size_t limit = skipLimit(base + i);
+        if (safe > limit) safe = limit;
+        if (safe >= min_skip) {
+          std::size_t run = safe < count - i ? safe : count - i;
+          skipAhead(peakBits, i, run);
+          onSkip(peakBits, i, run);
+          i += run;
+          continue;
+        }
+        if (perSample(base + i, (peakBits[i / 64] >> (i % 64)) & 1)) break;
+        i++;
+      }
+      if (history) history->append(peakBits, 0, i < count ? i + 1 : count);
+      if (i < count) {
+        peaks.stopAfter(block, i);
+        consumed = base + i + 1;
+        break;
+      }
+    }
+
+    samplesConsumed += consumed;
+    return consumed;
+  }
+
+  // One step of window bookkeeping for a sample whose peak bit is known.
+  void advance(bool isPeak) {
+    incrementDatumNum();
+    window.slide(datumNum, isPeak);
+    checkForAnomaly();
+  }
+
+  // What the batch calls do for a PeakTrace. NoTrace compiles away, so the
+  // calls without a trace are the same code as before there was one.
+  struct NoTrace {
+    std::size_t skipLimit(std::uint64_t) const {
+      return std::numeric_limits<std::size_t>::max();
+    }
+    void sample(std::uint64_t, std::size_t) {}
+  };
+
+  // To intern: the next traced sample number is kept instead of taking it
+  // modulo every for each sample, and slack skipping stops just short of it,
+  // so a sparse trace keeps most of the skipping.
+  template <typename Value>
+  class TraceWriter {
+  private:
+    PeakTrace<Value>& trace;
+    std::uint64_t next;
+    double toPercent;
+
+  public:
+    std::size_t skipLimit(std::uint64_t sample) const {
+      return (std::size_t)(next - sample);
+    }
+
+    void sample(std::uint64_t sample, std::size_t peaks) {
+      if (sample != next) return;
+      if constexpr (std::is_floating_point_v<Value>) {
+        trace.values[trace.written++] = (Value)(peaks * toPercent);
+      } else {
+        trace.values[trace.written++] = (Value)peaks;
+      }
+      next += trace.every;
+    }
+
+    // Throws std::runtime_error unless trace has room for every sample of
+    // the batch it could be asked to write.
+    TraceWriter(PeakTrace<Value>& trace, std::uint64_t first,
+                std::size_t size, unsigned int windowSize)
+      : trace(trace), toPercent(100.0 / windowSize) {
+      if (trace.every == 0) {
+        throw std::runtime_error("peak trace needs every >= 1");
+      }
+      next = first + (trace.every - 1 - first % trace.every);
+      std::size_t ahead = (std::size_t)(next - first);
+      std::size_t count = size > ahead ? (size - ahead - 1) / trace.every + 1
+                                       : 0;
+      if (trace.written > trace.values.size() ||
+          count > trace.values.size() - trace.written) {
+        throw std::runtime_error("peak trace has no room for the batch");
+      }
+    }
+  };
+
+  template <typename Tracer>
+  std::size_t batch(std::span<const Sample> data, Tracer& tracer) {
+    instrumentation::Probe<> probe(window.peakCount(), true);
+    std::uint64_t base = samplesConsumed;
+    std::size_t consumed = forEachSample(data,
+      [&](std::size_t index, bool isPeak) {
+        bool wasActive = alarmActive;
+        advance(isPeak);
+        probe.sample(isPeak, wasActive, alarmActive);
+        tracer.sample(base + index, window.peakCount());
+        return alarmActive;
+      }, [&](const std::uint64_t* peakBits, std::size_t first,
+             std::size_t count) {
+        probe.skip(count, peak_kernel::countBits(peakBits, first, count));
+      }, [&](std::size_t index) {return tracer.skipLimit(base + index);});
+    probe.finish(window.peakCount());
+    return alarmActive && consumed > 0 ? consumed - 1 : data.size();
+  }
+
+  template <typename OnEpisode, typename Tracer>
+  void scan(std::span<const Sample> data, OnEpisode& onEpisode,
+            Tracer& tracer) {
+    instrumentation::Probe<> probe(window.peakCount(), true);
+    std::uint64_t base = samplesConsumed;
+    forEachSample(data, [&](std::size_t index, bool isPeak) {
+      bool wasActive = alarmActive;
+      advance(isPeak);
+      probe.sample(isPeak, wasActive, alarmActive);
+      tracer.sample(base + index, window.peakCount());
+      if (wasActive || alarmActive) {
+        std::size_t peaks = window.peakCount();
+        if (!wasActive) {
+          openEpisode = AlarmEpisode{base + index, 0, peaks};
+        } else if (alarmActive) {
+          if (peaks < openEpisode.minPeakCount) {
+            openEpisode.minPeakCount = peaks;
+          }
+        } else {
+          openEpisode.end = base + index;
+          onEpisode(static_cast<const AlarmEpisode&>(openEpisode));
+        }
+      }
+      return false;
+    }, [&](const std::uint64_t* peakBits, std::size_t first,
+           std::size_t count) {
+      probe.skip(count, peak_kernel::countBits(peakBits, first, count));
+    }, [&](std::size_t index) {return tracer.skipLimit(base + index);});
+    probe.finish(window.peakCount());
+  }
+
+public:
+  // To intern: large integrating functions should be highly readable.
+  // Note: the probes (Instrumentation.hpp) compile to nothing unless
+  // ANOMALY_DETECTOR_INSTRUMENT is defined.
+  void processNewDataPoint(Sample dataPoint) {
+    instrumentation::Probe<> probe(window.peakCount(), false);
+    bool wasActive = alarmActive;
+
+    bool isPeak = peaks.step(dataPoint);
+    incrementDatumNum();
+    window.slide(datumNum, isPeak);
+    if (history) history->append(isPeak);
+
+    checkForAnomaly();
+    samplesConsumed++;
+
+    probe.sample(isPeak, wasActive, alarmActive);
+    probe.finish(window.peakCount());
+  }
+
+  // Consumes a packet of samples and returns the index (into data) of the
+  // first sample after which the alarm is active, or data.size() if it never
+  // was. Processing stops at that sample, so the detector is left exactly as
+  // if processNewDataPoint had been called on data[0..index]; resume with the
+  // rest of the packet if more alarms are of interest.
+  // Note: peaks are found a block at a time with SIMD compares (see
+  // PeakKernel.hpp), which leaves only the window bookkeeping per sample.
+  std::size_t processBatch(std::span<const Sample> data) {
+    NoTrace none;
+    return batch(data, none);
+  }
+
+  // processBatch that also writes the peak count into trace (see
+  // PeakTrace), up to the sample it stops at. Throws std::runtime_error
+  // before consuming anything if trace could run out of room.
+  template <typename Value>
+  std::size_t processBatch(std::span<const Sample> data,
+                           PeakTrace<Value>& trace) {
+    TraceWriter<Value> writer(trace, samplesConsumed, data.size(),
+                              threshold.windowSize());
+    return batch(data, writer);
+  }
+
+  // Consumes all of data and calls onEpisode(const AlarmEpisode&) for every
+  // alarm episode that ends (falling edge) inside it. An episode still open
+  // at the end of data carries over into the next call, see
+  // getOpenEpisode().
+  // Note: the edge check is one well predicted compare per sample, so a
+  // stream with no state changes runs as fast as processBatch.
+  template <typename OnEpisode>
+  void scanBatch(std::span<const Sample> data, OnEpisode&& onEpisode) {
+    NoTrace none;
+    scan(data, onEpisode, none);
+  }
+
+  // scanBatch that also writes the peak count into trace, see the
+  // processBatch form.
+  template <typename OnEpisode, typename Value>
+  void scanBatch(std::span<const Sample> data, OnEpisode&& onEpisode,
+                 PeakTrace<Value>& trace) {
+    TraceWriter<Value> writer(trace, samplesConsumed, data.size(),
+                              threshold.windowSize());
+    scan(data, onEpisode, writer);
+  }
+
+  // Convenience form of scanBatch that collects the finished episodes.
+  std::vector<AlarmEpisode> scanBatch(std::span<const Sample> data) {
+    std::vector<AlarmEpisode> episodes;
+    scanBatch(data, [&](const AlarmEpisode& episode) {
+      episodes.push_back(episode);
+    });
+    return episodes;
+  }
+
+  // The episode in progress (end is the current sample count), if the alarm
+  // is active. Useful to report an alarm that outlasts the data.
+  bool getOpenEpisode(AlarmEpisode& episode) const {
+    if (!alarmActive) return false;
+    episode = openEpisode;
+    episode.end = samplesConsumed;
+    return true;
+  }
+
+  // Checkpoint support (see Checkpoint.hpp): the peak state, counters, open
+  // episode and window contents, so a restored detector alarms on its very
+  // next sample exactly as this one would.
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    threshold.saveState(out);
+    peaks.saveState(out);
+    out.put(datumNum);
+    out.put(overflowOccured);
+    out.put(alarmActive);
+    out.put(samplesConsumed);
+    out.put(openEpisode);
+    window.saveState(out);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    threshold.restoreState(in);
+    peaks.restoreState(in);
+    in.get(datumNum);
+    in.get(overflowOccured);
+    in.get(alarmActive);
+    in.get(samplesConsumed);
+    in.get(openEpisode);
+    window.restoreState(in);
+  }
+
+  // Slack skipping (on by default) lets the batch calls take runs of
+  // samples that cannot raise the alarm without checking each one, see
+  // samplesWithoutAlarm. Results are identical either way; turning it off
+  // gives the exact per-sample path, e.g. to compare against.
+  void setSlackSkipping(bool enabled) {slackSkipping = enabled;}
+
+  // Records the peak bit of every sample consumed from now on into history
+  // (see PeakHistory.hpp), nullptr to stop. The history has to continue
+  // where this detector is: history.getEnd() == getSamplesConsumed(), so
+  // attach after restoring a checkpoint. Throws std::runtime_error if not.
+  // Note: with no history attached this costs one untaken branch per block
+  // (per sample in processNewDataPoint).
+  void attachHistory(PeakHistory* attached) {
+    if (attached && attached->getEnd() != samplesConsumed) {
+      throw std::runtime_error("peak history does not continue this detector");
+    }
+    history = attached;
+  }
+
+  // getters
+  bool getAlarmActive() {return alarmActive;}
+  bool getOverflowOccured() {return overflowOccured;}
+  Counter getDatumNum() const {return datumNum;}
+  std::uint64_t getSamplesConsumed() const {return samplesConsumed;}
+
+  // To intern: by allowing for params we add reuasbility.
+
+  // Note: a window size of 0 would underflow the window bookkeeping, so it
+  // throws std::invalid_argument (see RuntimeThreshold and PeakWindow.hpp).
+  BasicAnomalyDetector(
+      unsigned int windowSize = defaults::window_size,
+      unsigned int alarmPercentage = defaults::alarm_percentage)
+    requires (!Threshold::is_static &&
+              std::is_constructible_v<PeakWindow, unsigned int>)
+    : window(windowSize), threshold(windowSize, alarmPercentage) {}
+
+  // For windows that need more than a size to be built (ArenaPeakWindow):
+  // the window is passed in ready made.
+  BasicAnomalyDetector(
+      PeakWindow window,
+      unsigned int alarmPercentage = defaults::alarm_percentage)
+    requires (!Threshold::is_static &&
+              !std::is_constructible_v<PeakWindow, unsigned int>)
+    : window(window),
+      threshold(window.getWindowSize(), alarmPercentage) {}
+
+  // Note: compile-time configured detectors take no arguments, the template
+  // parameters are the configuration.
+  BasicAnomalyDetector() requires Threshold::is_static {}
+};
+
+using AnomalyDetector = BasicAnomalyDetector<DequePeakWindow>;
+using RingAnomalyDetector = BasicAnomalyDetector<BitRingPeakWindow>;
+
+// Runtime configured bit ring detector with a different peak definition,
+// e.g. PolicyAnomalyDetector<PlateauPeakPolicy>.
+template <typename PeakPolicy>
+using PolicyAnomalyDetector =
+  BasicAnomalyDetector<BitRingPeakWindow, RuntimeThreshold, PeakPolicy>;
+
+// Runtime configured bit ring detector for another sample type, e.g.
+// TypedAnomalyDetector<std::int64_t> or TypedAnomalyDetector<float>.
+template <typename Sample>
+using TypedAnomalyDetector =
+  BasicAnomalyDetector<BitRingPeakWindow, RuntimeThreshold,
+                       BasicStrictPeakPolicy<Sample>>;
+
+template <unsigned int WindowSize = defaults::window_size,
+          unsigned int AlarmPercentage = defaults::alarm_percentage>
+using StaticAnomalyDetector =
+  BasicAnomalyDetector<StaticPeakWindow<WindowSize>,
+                       StaticThreshold<WindowSize, AlarmPercentage>>;
+
+#endif
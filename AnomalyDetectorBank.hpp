@@ -0,0 +1,240 @@
+// NOTE: README.md contains summary docs
+
+#ifndef ANOMALY_DETECTOR_BANK_HPP
+#define ANOMALY_DETECTOR_BANK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "AlarmThreshold.hpp"
+#include "AnomalyDetector.hpp"
+
+// Many channels, one detector. Equivalent to one AnomalyDetector per channel
+// fed in lockstep, but the state is kept as structure-of-arrays:
+//   * prevPoint       one int per channel
+//   * possiblePeaks   one bit per channel (prevIsPossiblePeak)
+//   * windowRows      windowSize rows of one bit per channel, used as a ring
+//   * peakCounts      one count per channel
+//   * alarms          one bit per channel
+// Every channel receives exactly one sample per tick, so all channels share
+// the tick counter and the ring position; a tick only touches one row of the
+// window. Frames are interleaved: frame t holds sample t of channel 0, 1, ...
+// Note: the tick counter is 64 bits, so unlike AnomalyDetector there is no
+// overflow handling to speak of.
+class AnomalyDetectorBank {
+private:
+  std::size_t channels;
+  std::size_t words;
+  RuntimeThreshold threshold;
+  std::uint64_t ticks = 0;
+  unsigned int position = 0;
+
+  std::vector<int> prevPoint;
+  std::vector<std::uint64_t> possiblePeaks;
+  std::vector<std::uint64_t> windowRows;
+  std::vector<std::uint32_t> peakCounts;
+  std::vector<std::uint64_t> alarms;
+
+  // Handles channels [begin, end) of one 64 channel word and returns the
+  // alarm bits for them (relative to the word).
+  std::uint64_t updateScalar(const int* frame, std::size_t word,
+                             std::size_t begin, std::size_t end,
+                             std::uint64_t& peakBits, std::uint64_t& risingBits,
+                             std::uint64_t outgoing, bool hasPrevPoint) {
+    std::uint64_t possible = possiblePeaks[word];
+    std::uint64_t below = 0;
+    for (std::size_t c = begin; c < end; c++) {
+      unsigned int lane = c % 64;
+      int dataPoint = frame[c];
+      std::uint64_t isPeak =
+        (dataPoint < prevPoint[c]) & ((possible >> lane) & 1);
+      std::uint64_t isRising = (dataPoint > prevPoint[c]) & hasPrevPoint;
+      prevPoint[c] = dataPoint;
+
+      peakCounts[c] += (std::uint32_t)isPeak - ((outgoing >> lane) & 1);
+      peakBits |= isPeak << lane;
+      risingBits |= isRising << lane;
+      below |= std::uint64_t(peakCounts[c] < threshold.minimumPeaks()) << lane;
+    }
+    return below;
+  }
+
+#if defined(__AVX2__)
+  // Same as updateScalar for 8 channels starting at c (c % 8 == 0).
+  std::uint64_t updateLanes(const int* frame, std::size_t c,
+                            std::uint64_t& peakBits, std::uint64_t& risingBits,
+                            std::uint64_t outgoing, bool hasPrevPoint) {
+    const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    unsigned int lane = c % 64;
+    int possible8 = (int)((possiblePeaks[c / 64] >> lane) & 0xff);
+    int outgoing8 = (int)((outgoing >> lane) & 0xff);
+
+    __m256i dataPoints = _mm256_loadu_si256((const __m256i*)(frame + c));
+    __m256i previous = _mm256_loadu_si256((const __m256i*)(&prevPoint[c]));
+    __m256i possible = _mm256_cmpeq_epi32(
+      _mm256_and_si256(_mm256_set1_epi32(possible8), laneBits), laneBits);
+    __m256i leaving = _mm256_cmpeq_epi32(
+      _mm256_and_si256(_mm256_set1_epi32(outgoing8), laneBits), laneBits);
+
+    __m256i isPeak = _mm256_and_si256(
+      _mm256_cmpgt_epi32(previous, dataPoints), possible);
+    __m256i isRising = _mm256_cmpgt_epi32(dataPoints, previous);
+    _mm256_storeu_si256((__m256i*)(&prevPoint[c]), dataPoints);
+
+    // masks are -1 where set, so subtracting isPeak adds one peak
+    __m256i counts = _mm256_loadu_si256((const __m256i*)(&peakCounts[c]));
+    counts = _mm256_add_epi32(_mm256_sub_epi32(counts, isPeak), leaving);
+    _mm256_storeu_si256((__m256i*)(&peakCounts[c]), counts);
+
+    __m256i minimum = _mm256_set1_epi32((int)threshold.minimumPeaks());
+    __m256i below = _mm256_cmpgt_epi32(minimum, counts);
+
+    auto bitsOf = [](__m256i mask) {
+      return (std::uint64_t)(unsigned)_mm256_movemask_ps(
+        _mm256_castsi256_ps(mask));
+    };
+    peakBits |= bitsOf(isPeak) << lane;
+    risingBits |= (hasPrevPoint ? bitsOf(isRising) : 0) << lane;
+    return bitsOf(below) << lane;
+  }
+#endif
+
+public:
+  // Consumes one sample for every channel. Throws std::invalid_argument
+  // unless frame.size() == channelCount().
+  void processFrame(std::span<const int> frame) {
+    if (frame.size() != channels) {
+      throw std::invalid_argument("frame does not hold one sample per channel");
+    }
+    bool hasPrevPoint = ticks > 0;
+    ticks++;
+    bool minDataReceived = ticks >= threshold.windowSize();
+    std::uint64_t* row = &windowRows[position * words];
+
+    for (std::size_t w = 0; w < words; w++) {
+      std::size_t begin = w * 64;
+      std::size_t end = begin + 64 < channels ? begin + 64 : channels;
+      std::uint64_t outgoing = row[w];
+      std::uint64_t peakBits = 0;
+      std::uint64_t risingBits = 0;
+      std::uint64_t below = 0;
+      std::size_t c = begin;
+
+#if defined(__AVX2__)
+      for (; c + 8 <= end; c += 8) {
+        below |= updateLanes(frame.data(), c, peakBits, risingBits, outgoing,
+                             hasPrevPoint);
+      }
+#endif
+      below |= updateScalar(frame.data(), w, c, end, peakBits, risingBits,
+                            outgoing, hasPrevPoint);
+
+      row[w] = peakBits;
+      possiblePeaks[w] = risingBits;
+      alarms[w] = minDataReceived ? below : 0;
+    }
+
+    position = position + 1 == threshold.windowSize() ? 0 : position + 1;
+  }
+
+  // Consumes interleaved frames. Like AnomalyDetector::processBatch it stops
+  // after the first frame that leaves any channel in alarm and returns that
+  // frame's index, or the number of frames if no channel alarmed. Throws
+  // std::invalid_argument, before consuming anything, unless frames.size()
+  // is a multiple of channelCount().
+  std::size_t processFrames(std::span<const int> frames) {
+    if (frames.size() % channels != 0) {
+      throw std::invalid_argument("frames end with a partial frame");
+    }
+    std::size_t frameCount = frames.size() / channels;
+    for (std::size_t t = 0; t < frameCount; t++) {
+      processFrame(frames.subspan(t * channels, channels));
+      if (getAnyAlarmActive()) return t;
+    }
+    return frameCount;
+  }
+
+  // Checkpoint support (see Checkpoint.hpp). The per-channel arrays are
+  // stored cache line aligned, so restoring a bank is a handful of copies
+  // straight out of the mapped file.
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(std::uint64_t(channels));
+    threshold.saveState(out);
+    out.put(ticks);
+    out.put(position);
+    auto putAligned = [&](const auto& values) {
+      out.align(64);
+      out.putArray(values.data(), values.size());
+    };
+    putAligned(prevPoint);
+    putAligned(possiblePeaks);
+    putAligned(windowRows);
+    putAligned(peakCounts);
+    putAligned(alarms);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    in.expect(std::uint64_t(channels), "channel count");
+    threshold.restoreState(in);
+    in.get(ticks);
+    in.get(position);
+    if (position >= threshold.windowSize()) {
+      throw std::runtime_error("checkpoint has a bad window position");
+    }
+    auto getAligned = [&](auto& values) {
+      in.align(64);
+      in.getArray(values.data(), values.size());
+    };
+    getAligned(prevPoint);
+    getAligned(possiblePeaks);
+    getAligned(windowRows);
+    getAligned(peakCounts);
+    getAligned(alarms);
+  }
+
+  // getters
+  // Note: bit c % 64 of word c / 64 is set while channel c is in alarm.
+  std::span<const std::uint64_t> getAlarmBitmap() const {return alarms;}
+  bool getAlarmActive(std::size_t channel) const {
+    return (alarms[channel / 64] >> (channel % 64)) & 1;
+  }
+  bool getAnyAlarmActive() const {
+    std::uint64_t any = 0;
+    for (std::uint64_t word : alarms) any |= word;
+    return any != 0;
+  }
+  std::uint32_t getPeakCount(std::size_t channel) const {
+    return peakCounts[channel];
+  }
+  std::size_t channelCount() const {return channels;}
+  std::uint64_t getTicks() const {return ticks;}
+
+  // Throws std::invalid_argument for a bank without channels or a window
+  // size of 0.
+  AnomalyDetectorBank(std::size_t channels,
+                      unsigned int windowSize = defaults::window_size,
+                      unsigned int alarmPercentage = defaults::alarm_percentage)
+    : channels(channels),
+      words((channels + 63) / 64),
+      threshold(windowSize, alarmPercentage),
+      prevPoint(channels, 0),
+      possiblePeaks(words, 0),
+      windowRows(std::size_t(windowSize) * words, 0),
+      peakCounts(channels, 0),
+      alarms(words, 0) {
+    if (channels == 0) {
+      throw std::invalid_argument("a bank needs at least one channel");
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,267 @@
+// NOTE: README.md contains summary docs
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ReplayFile.hpp"
+
+// Binary checkpoints of detector state, so a restarted or standby process
+// carries on with a full window instead of re-consuming windowSize samples
+// before it can alarm again.
+//
+// Anything with
+//   template <typename Writer> void saveState(Writer& out) const
+//   template <typename Reader> void restoreState(Reader& in)
+// can be checkpointed (every detector, window, peak policy and threshold in
+// this repo, and AnomalyDetectorBank). A file holds a header followed by one
+// record per object, back to back:
+//   magic "ADCKPT\0\0", uint32 version, uint32 object count, uint64 payload
+//   bytes, then the payload
+//   record: uint64 type tag, uint64 state bytes, then the object's state
+// Note: the layout is native (host endianness and struct layout), meant for
+// handing state to another process of the same build on the same kind of
+// machine, not for archiving. State is restored into an object of the same
+// type and configuration; a mismatch (including a record saved from another
+// type, or window contents that disagree with their peak count) throws
+// std::runtime_error and leaves the object in an unspecified state.
+namespace checkpoint
+{
+    static const char magic[8] = {'A', 'D', 'C', 'K', 'P', 'T', 0, 0};
+    // Note: version 2 widened the detectors' sample counter to 64 bits,
+    // version 3 added the per-object type tag and size.
+    static const std::uint32_t version = 3;
+    static const std::size_t header_size = 24;
+
+    class Writer {
+    private:
+      std::vector<unsigned char>& out;
+
+    public:
+      template <typename T>
+      void put(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        putArray(&value, 1);
+      }
+
+      template <typename T>
+      void putArray(const T* values, std::size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const unsigned char* bytes =
+          reinterpret_cast<const unsigned char*>(values);
+        out.insert(out.end(), bytes, bytes + count * sizeof(T));
+      }
+
+      // Zero pads to a multiple of alignment (from the start of the file,
+      // which out begins with), so large arrays can be copied out of the
+      // mapping a cache line at a time.
+      void align(std::size_t alignment) {
+        std::size_t offset = out.size();
+        out.resize(out.size() + (alignment - offset % alignment) % alignment);
+      }
+
+      explicit Writer(std::vector<unsigned char>& out) : out(out) {}
+    };
+
+    class Reader {
+    private:
+      std::span<const unsigned char> in;
+      std::size_t position = 0;
+
+      const unsigned char* take(std::size_t bytes) {
+        if (in.size() - position < bytes) {
+          throw std::runtime_error("checkpoint is truncated");
+        }
+        const unsigned char* taken = in.data() + position;
+        position += bytes;
+        return taken;
+      }
+
+    public:
+      template <typename T>
+      void get(T& value) {
+        getArray(&value, 1);
+      }
+
+      template <typename T>
+      void getArray(T* values, std::size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        std::memcpy(values, take(count * sizeof(T)), count * sizeof(T));
+      }
+
+      // Reads a value that has to match the restoring object's
+      // configuration, e.g. the window size.
+      template <typename T>
+      void expect(const T& value, const char* what) {
+        T stored;
+        get(stored);
+        if (stored != value) {
+          throw std::runtime_error(std::string("checkpoint has a different ") +
+                                   what);
+        }
+      }
+
+      void align(std::size_t alignment) {
+        std::size_t offset = header_size + position;
+        take((alignment - offset % alignment) % alignment);
+      }
+
+      std::size_t remaining() const {return in.size() - position;}
+
+      explicit Reader(std::span<const unsigned char> in) : in(in) {}
+    };
+
+    // Tag of the type a record was saved from: FNV-1a of the type as the
+    // compiler spells it. Records of types with the same field sizes (a
+    // detector over int and one over float) look alike otherwise.
+    template <typename State>
+    constexpr std::uint64_t typeTag() {
+      std::uint64_t hash = 14695981039346656037ull;
+      for (char c : std::string_view(__PRETTY_FUNCTION__)) {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+      }
+      return hash;
+    }
+
+    // Syncs the directory holding path, so a rename into it is durable.
+    inline void syncDirectory(const std::string& path) {
+      std::size_t slash = path.find_last_of('/');
+      std::string directory = slash == std::string::npos ? "."
+        : slash == 0 ? "/" : path.substr(0, slash);
+      int descriptor = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+      if (descriptor < 0) {
+        throw std::runtime_error("cannot open " + directory + ": " +
+                                 std::strerror(errno));
+      }
+      if (fsync(descriptor) != 0) {
+        int error = errno;
+        close(descriptor);
+        throw std::runtime_error("cannot sync " + directory + ": " +
+                                 std::strerror(error));
+      }
+      close(descriptor);
+    }
+
+    // To intern: the state goes to a temporary file which is renamed over
+    // the old checkpoint once it is complete and synced, so a reader (or a
+    // crash halfway through) only ever sees the old or the new checkpoint.
+    // The directory is synced after the rename, otherwise a crash can still
+    // lose the rename (and with it the new checkpoint) on some filesystems.
+    template <typename State>
+    void save(const std::string& path, std::span<const State> objects) {
+      std::vector<unsigned char> file(header_size);
+      Writer writer(file);
+      for (const State& object : objects) {
+        writer.put(typeTag<State>());
+        std::size_t sizeAt = file.size();
+        writer.put(std::uint64_t(0));
+        object.saveState(writer);
+        std::uint64_t size = file.size() - sizeAt - sizeof(size);
+        std::memcpy(file.data() + sizeAt, &size, sizeof(size));
+      }
+
+      std::uint32_t count = (std::uint32_t)objects.size();
+      std::uint64_t payload = file.size() - header_size;
+      std::memcpy(file.data(), magic, sizeof(magic));
+      std::memcpy(file.data() + 8, &version, sizeof(version));
+      std::memcpy(file.data() + 12, &count, sizeof(count));
+      std::memcpy(file.data() + 16, &payload, sizeof(payload));
+
+      std::string temporary = path + ".tmp";
+      int descriptor = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                            0644);
+      if (descriptor < 0) {
+        throw std::runtime_error("cannot create " + temporary + ": " +
+                                 std::strerror(errno));
+      }
+      std::size_t written = 0;
+      while (written < file.size()) {
+        ssize_t result = write(descriptor, file.data() + written,
+                               file.size() - written);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) {
+          close(descriptor);
+          throw std::runtime_error("cannot write " + temporary + ": " +
+                                   std::strerror(errno));
+        }
+        written += result;
+      }
+      if (fsync(descriptor) != 0 || close(descriptor) != 0) {
+        throw std::runtime_error("cannot sync " + temporary + ": " +
+                                 std::strerror(errno));
+      }
+      if (rename(temporary.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("cannot rename " + temporary + ": " +
+                                 std::strerror(errno));
+      }
+      syncDirectory(path);
+    }
+
+    template <typename State>
+    void save(const std::string& path, const State& object) {
+      save(path, std::span<const State>(&object, 1));
+    }
+
+    // Maps the file and restores objects.size() objects from it, in the
+    // order they were saved.
+    template <typename State>
+    void restore(const std::string& path, std::span<State> objects) {
+      MappedFile file(path);
+      std::span<const unsigned char> bytes = file.bytes();
+
+      std::uint32_t storedVersion;
+      std::uint32_t count;
+      std::uint64_t payload;
+      if (bytes.size() < header_size ||
+          std::memcmp(bytes.data(), magic, sizeof(magic)) != 0) {
+        throw std::runtime_error(path + " is not a checkpoint");
+      }
+      std::memcpy(&storedVersion, bytes.data() + 8, sizeof(storedVersion));
+      std::memcpy(&count, bytes.data() + 12, sizeof(count));
+      std::memcpy(&payload, bytes.data() + 16, sizeof(payload));
+      if (storedVersion != version) {
+        throw std::runtime_error(path + " has an unsupported version");
+      }
+      if (count != objects.size()) {
+        throw std::runtime_error(path + " holds a different object count");
+      }
+      if (payload != bytes.size() - header_size) {
+        throw std::runtime_error(path + " is truncated");
+      }
+
+      Reader reader(bytes.subspan(header_size));
+      for (State& object : objects) {
+        reader.expect(typeTag<State>(), "object type");
+        std::uint64_t size;
+        reader.get(size);
+        std::size_t before = reader.remaining();
+        object.restoreState(reader);
+        if (before - reader.remaining() != size) {
+          throw std::runtime_error(path + " has a record of another size");
+        }
+      }
+      if (reader.remaining() != 0) {
+        throw std::runtime_error(path + " has trailing data");
+      }
+    }
+
+    template <typename State>
+    void restore(const std::string& path, State& object) {
+      restore(path, std::span<State>(&object, 1));
+    }
+}
+
+#endif
@@ -0,0 +1,43 @@
+// NOTE: README.md contains summary docs
+
+#ifndef COMMAND_LINE_HPP
+#define COMMAND_LINE_HPP
+
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <system_error>
+
+// Argument parsing for the modes of the AnomalyDetector executable.
+namespace command_line
+{
+    // Reads the numeric argument argv[index] of a mode into value, which
+    // keeps its default if the argument is not given. Returns false, after
+    // writing why to errors, unless it is a whole number in [minimum,
+    // maximum].
+    // To intern: std::stoul wraps "-1" to a huge size, accepts "12x" and
+    // throws on "x", and a window size of 0 used to crash the detector, so
+    // every size a user passes in goes through here.
+    template <typename Value>
+    bool readArgument(int argc, char* argv[], int index, const char* what,
+                      std::uint64_t minimum, std::uint64_t maximum,
+                      Value& value, std::ostream& errors = std::cerr) {
+      if (argc <= index) return true;
+      std::string text = argv[index];
+      std::uint64_t parsed = 0;
+      auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), parsed);
+      if (error != std::errc() || end != text.data() + text.size() ||
+          parsed < minimum || parsed > maximum) {
+        errors << what << " must be a whole number from " << minimum
+               << " to " << maximum << ", not \"" << text << "\""
+               << std::endl;
+        return false;
+      }
+      value = (Value)parsed;
+      return true;
+    }
+}
+
+#endif
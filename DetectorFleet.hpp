@@ -0,0 +1,158 @@
+// NOTE: README.md contains summary docs
+
+#ifndef DETECTOR_FLEET_HPP
+#define DETECTOR_FLEET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "AnomalyDetector.hpp"
+#include "PeakWindow.hpp"
+
+// A fixed number of channel slots, each an independent detector, for fleets
+// where channels come and go (unlike AnomalyDetectorBank, which feeds every
+// channel in lockstep). The whole fleet lives in one arena allocated up
+// front: slot i holds a detector followed by the words of its ArenaPeakWindow
+// bit ring, so a channel is one contiguous stretch of memory and a fleet is
+// one allocation however many channels it holds.
+// To intern: create() pops a slot off a free list and resets it, destroy()
+// pushes it back. Neither touches the allocator, so churning channels costs
+// O(1) (plus clearing windowSize bits) and cannot fragment the heap, which a
+// std::deque per AnomalyDetector does at 100k channels.
+class DetectorFleet {
+public:
+  using Detector = BasicAnomalyDetector<ArenaPeakWindow>;
+  using Channel = std::uint32_t;
+
+  // What the fleet holds, in bytes. Everything is allocated by the
+  // constructor; nothing grows afterwards.
+  struct Footprint {
+    std::size_t windowBytes;     // bit rings in the arena
+    std::size_t detectorBytes;   // detectors in the arena
+    std::size_t freeListBytes;   // free list and liveness flags
+    std::size_t capacity;
+    std::size_t live;
+
+    std::size_t total() const {
+      return windowBytes + detectorBytes + freeListBytes;
+    }
+    std::size_t perChannel() const {
+      return capacity == 0 ? 0 : total() / capacity;
+    }
+  };
+
+private:
+  // Note: slots are never destroyed, only overwritten, which is fine for a
+  // type with a trivial destructor.
+  static_assert(std::is_trivially_destructible_v<Detector>);
+  static_assert(alignof(Detector) <= alignof(std::uint64_t));
+  static const std::size_t detector_words =
+    (sizeof(Detector) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+  unsigned int windowSize;
+  unsigned int alarmPercentage;
+  std::size_t ringWords;
+  std::size_t stride;
+  std::size_t slots;
+  std::vector<std::uint64_t> arena;
+  std::vector<Channel> freeChannels;
+  std::vector<unsigned char> liveChannels;
+
+  std::uint64_t* slot(Channel channel) {
+    return arena.data() + channel * stride;
+  }
+  const std::uint64_t* slot(Channel channel) const {
+    return arena.data() + channel * stride;
+  }
+
+  // Builds a fresh detector over a cleared ring in the slot.
+  void reset(Channel channel) {
+    std::uint64_t* ring = slot(channel) + detector_words;
+    for (std::size_t i = 0; i < ringWords; i++) ring[i] = 0;
+    new (slot(channel))
+      Detector(ArenaPeakWindow(ring, windowSize), alarmPercentage);
+  }
+
+public:
+  // Throws std::runtime_error when every slot is taken.
+  Channel create() {
+    if (freeChannels.empty()) {
+      throw std::runtime_error("detector fleet is full");
+    }
+    Channel channel = freeChannels.back();
+    freeChannels.pop_back();
+
+    reset(channel);
+    liveChannels[channel] = 1;
+    return channel;
+  }
+
+  // The slot is reused by a later create(). Throws std::runtime_error for a
+  // channel that is not live.
+  void destroy(Channel channel) {
+    if (!isLive(channel)) {
+      throw std::runtime_error("detector fleet channel is not live");
+    }
+    liveChannels[channel] = 0;
+    freeChannels.push_back(channel);
+  }
+
+  bool isLive(Channel channel) const {
+    return channel < liveChannels.size() && liveChannels[channel];
+  }
+
+  // Note: no liveness check, like std::vector::operator[].
+  Detector& operator[](Channel channel) {
+    return *std::launder(reinterpret_cast<Detector*>(slot(channel)));
+  }
+  const Detector& operator[](Channel channel) const {
+    return *std::launder(reinterpret_cast<const Detector*>(slot(channel)));
+  }
+
+  Footprint footprint() const {
+    return {slots * ringWords * sizeof(std::uint64_t),
+            slots * detector_words * sizeof(std::uint64_t),
+            freeChannels.capacity() * sizeof(Channel) +
+              liveChannels.capacity(),
+            slots,
+            size()};
+  }
+
+  // getters
+  std::size_t size() const {return slots - freeChannels.size();}
+  std::size_t capacity() const {return slots;}
+  unsigned int getWindowSize() const {return windowSize;}
+  unsigned int getAlarmPercentage() const {return alarmPercentage;}
+
+  // Note: slots are handed out lowest channel first. Throws
+  // std::invalid_argument for a window size of 0, even for an empty fleet.
+  DetectorFleet(std::size_t capacity,
+                unsigned int windowSize = defaults::window_size,
+                unsigned int alarmPercentage = defaults::alarm_percentage)
+    : windowSize(windowSize),
+      alarmPercentage(alarmPercentage),
+      ringWords(ArenaPeakWindow::words(windowSize)),
+      stride(detector_words + ringWords),
+      slots(capacity),
+      arena(capacity * stride),
+      liveChannels(capacity, 0) {
+    if (windowSize == 0) {
+      throw std::invalid_argument("window size must be at least 1");
+    }
+    freeChannels.reserve(capacity);
+    for (std::size_t i = 0; i < capacity; i++) {
+      reset((Channel)i);
+      freeChannels.push_back((Channel)(capacity - 1 - i));
+    }
+  }
+
+  // Detectors point into the arena, so the fleet stays where it was built.
+  DetectorFleet(const DetectorFleet&) = delete;
+  DetectorFleet& operator=(const DetectorFleet&) = delete;
+};
+
+#endif
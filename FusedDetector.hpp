@@ -0,0 +1,185 @@
+// NOTE: README.md contains summary docs
+
+#ifndef FUSED_DETECTOR_HPP
+#define FUSED_DETECTOR_HPP
+
+#include <bit>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "AlarmThreshold.hpp"
+#include "AnomalyDetector.hpp"
+#include "PeakKernel.hpp"
+
+// The default configuration (strict peaks, bit ring window, runtime
+// threshold) as one loop. BasicAnomalyDetector splits a sample into peak
+// finding, counter increment, window slide and alarm check, each going
+// through member state; here a batch runs on locals, written back once at
+// the end, one stretch of the ring (up to one 64 bit word) at a time:
+//   * window      the ring word is loaded once per stretch; its bits are the
+//                 samples leaving, the peaks found become the new word
+//   * is peak     (x[i] < x[i-1]) & (x[i-1] > x[i-2]) as branchless
+//                 compares, through the peak kernel while data is in L1
+//   * alarm       the count only drops where a peak leaves and no peak comes
+//                 in, so only those samples are checked, and only when there
+//                 are more of them than peaks to spare
+// While in alarm (or warming up) each sample is stepped on its own with the
+// count update and a single alarm compare.
+// Note: alarms and stops are identical to AnomalyDetector's exact per-sample
+// path (AnomalyDetector_tests checks this). The sample counter is 64 bits, so
+// there is no renumbering on overflow.
+class FusedAnomalyDetector {
+private:
+  // To intern: starting from INT_MAX makes sample 0 neither a possible peak
+  // nor a confirmed one, which saves a "have a previous point" flag.
+  int prevPoint = INT_MAX;
+  std::uint32_t prevIsPossiblePeak = 0;
+  std::uint32_t peaks = 0;
+  unsigned int position = 0;
+  bool alarmActive = false;
+  std::uint64_t samplesConsumed = 0;
+
+  RuntimeThreshold threshold;
+  std::vector<std::uint64_t> ring;
+
+public:
+  // One sample stepped on its own, like the in-alarm loop of processBatch,
+  // without setting up a batch for it.
+  void processNewDataPoint(int dataPoint) {
+    unsigned int shift = position % 64;
+    std::uint64_t& word = ring[position / 64];
+    std::uint32_t isPeak =
+      (std::uint32_t)(dataPoint < prevPoint) & prevIsPossiblePeak;
+    prevIsPossiblePeak = dataPoint > prevPoint;
+    prevPoint = dataPoint;
+
+    peaks += isPeak - (std::uint32_t)((word >> shift) & 1);
+    word = (word & ~(std::uint64_t(1) << shift)) |
+           (std::uint64_t(isPeak) << shift);
+    samplesConsumed++;
+    position = position + 1 == threshold.windowSize() ? 0 : position + 1;
+    alarmActive = (samplesConsumed >= threshold.windowSize()) &
+                  (peaks < threshold.minimumPeaks());
+  }
+
+  // Same contract as AnomalyDetector::processBatch: returns the index of the
+  // first sample after which the alarm is active, or data.size(), and stops
+  // there.
+  std::size_t processBatch(std::span<const int> data) {
+    const int* samples = data.data();
+    const std::size_t size = data.size();
+    const unsigned int windowSize = threshold.windowSize();
+    const std::uint32_t minimum = threshold.minimumPeaks();
+    std::uint64_t* words = ring.data();
+
+    int prev = prevPoint;
+    std::uint32_t possible = prevIsPossiblePeak;
+    std::uint32_t count = peaks;
+    unsigned int pos = position;
+    std::uint64_t consumed = samplesConsumed;
+    bool alarm = alarmActive;
+
+    std::size_t i = 0;
+    while (i < size) {
+      // one stretch of the ring within one word
+      unsigned int shift = pos % 64;
+      std::size_t stretch = 64 - shift;
+      if (stretch > windowSize - pos) stretch = windowSize - pos;
+      if (stretch > size - i) stretch = size - i;
+
+      std::uint64_t old = words[pos / 64] >> shift;
+      std::uint64_t fresh = 0;
+      std::size_t j = 0;
+
+      if (consumed + 1 >= windowSize && count > minimum) {
+        // Out of alarm with peaks to spare: find the stretch's peaks, then
+        // look for an alarm only where the count drops (a peak leaving, no
+        // peak coming in), and only if there are more drops than slack.
+        int before = prev;
+        peak_kernel::Carry carry = {prev, possible != 0, true};
+        peak_kernel::findPeaks(samples + i, stretch, carry, &fresh);
+        carry = peak_kernel::carryAfter(samples + i, stretch - 1, carry);
+        prev = carry.prevPoint;
+        possible = carry.prevIsPossiblePeak;
+        j = stretch;
+        std::uint64_t outgoing = stretch == 64
+          ? old
+          : old & ((std::uint64_t(1) << stretch) - 1);
+        std::uint64_t drops = outgoing & ~fresh;
+        if ((std::uint32_t)std::popcount(drops) > count - minimum) {
+          for (; drops != 0; drops &= drops - 1) {
+            unsigned int at = std::countr_zero(drops);
+            std::uint64_t upTo = at == 63
+              ? ~std::uint64_t(0)
+              : ((std::uint64_t(2) << at) - 1);
+            std::uint32_t dipped = count + std::popcount(fresh & upTo) -
+                                   std::popcount(outgoing & upTo);
+            if (dipped < minimum) {
+              // stop after sample at, rewinding the peak state to it
+              j = at + 1;
+              fresh &= upTo;
+              outgoing &= upTo;
+              prev = samples[i + at];
+              possible = prev > (at > 0 ? samples[i + at - 1] : before);
+              alarm = true;
+              break;
+            }
+          }
+        }
+        count += std::popcount(fresh) - std::popcount(outgoing);
+        consumed += j;
+      } else {
+        while (j < stretch) {
+          int value = samples[i + j];
+          std::uint32_t isPeak = (std::uint32_t)(value < prev) & possible;
+          possible = value > prev;
+          prev = value;
+
+          fresh |= std::uint64_t(isPeak) << j;
+          count += isPeak - (std::uint32_t)((old >> j) & 1);
+          consumed++;
+          j++;
+          alarm = (consumed >= windowSize) & (count < minimum);
+          if (alarm) break;
+        }
+      }
+
+      std::uint64_t mask = j == 64
+        ? ~std::uint64_t(0)
+        : ((std::uint64_t(1) << j) - 1);
+      std::uint64_t& word = words[pos / 64];
+      word = (word & ~(mask << shift)) | (fresh << shift);
+      pos += j;
+      if (pos == windowSize) pos = 0;
+      i += j;
+      if (alarm) break;
+    }
+
+    prevPoint = prev;
+    prevIsPossiblePeak = possible;
+    peaks = count;
+    position = pos;
+    samplesConsumed = consumed;
+    alarmActive = alarm;
+    return alarm && i > 0 ? i - 1 : size;
+  }
+
+  std::size_t peakCount() const {return peaks;}
+
+  // getters
+  bool getAlarmActive() const {return alarmActive;}
+  std::uint64_t getSamplesConsumed() const {return samplesConsumed;}
+
+  // Throws std::invalid_argument for a window size of 0 (from the
+  // threshold, before anything is allocated).
+  FusedAnomalyDetector(
+      unsigned int windowSize = defaults::window_size,
+      unsigned int alarmPercentage = defaults::alarm_percentage)
+    : threshold(windowSize, alarmPercentage),
+      ring((windowSize + 63) / 64, 0) {}
+};
+
+#endif
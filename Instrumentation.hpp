@@ -0,0 +1,266 @@
+// NOTE: README.md contains summary docs
+
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Optional counters and batch latency histograms for the detector hot path.
+// Compiled in when ANOMALY_DETECTOR_INSTRUMENT is defined (CMake option of
+// the same name), otherwise every hook is an empty inline function and the
+// detectors compile to exactly the uninstrumented code.
+//
+// Each thread owns a record it alone writes to. A detector call tallies its
+// events in locals and adds them to the record once, at the end of the call
+// (per sample for processNewDataPoint, per batch otherwise). snapshot()
+// merges all records, including those of threads that have exited, and can
+// run while the detectors do.
+// To intern: with one writer per record a relaxed load and store is enough,
+// which compiles to plain moves. There is no locked instruction or shared
+// cache line on the hot path, unlike a global std::atomic counter.
+namespace instrumentation
+{
+#if defined(ANOMALY_DETECTOR_INSTRUMENT)
+    inline constexpr bool enabled = true;
+#else
+    inline constexpr bool enabled = false;
+#endif
+
+    struct Counters {
+      std::uint64_t samples = 0;
+      std::uint64_t peaks = 0;
+      std::uint64_t prunes = 0;        // peaks that aged out of a window
+      std::uint64_t alarmsRaised = 0;
+      std::uint64_t alarmsCleared = 0;
+      std::uint64_t batches = 0;
+    };
+
+    // HDR style log-linear histogram: exact below 64, then 32 buckets per
+    // power of two (about 3% resolution) up to the full 64 bit range.
+    class LatencyHistogram {
+    public:
+      static const std::size_t bucket_count = 64 + 58 * 32;
+
+      static std::size_t bucketFor(std::uint64_t value) {
+        if (value < 64) return value;
+        unsigned int shift = std::bit_width(value) - 6;
+        return 64 + (shift - 1) * 32 + ((value >> shift) - 32);
+      }
+
+      // Largest value that lands in bucket index.
+      static std::uint64_t highestIn(std::size_t index) {
+        if (index < 64) return index;
+        unsigned int shift = (index - 64) / 32 + 1;
+        std::uint64_t sub = (index - 64) % 32 + 32;
+        return ((sub + 1) << shift) - 1;
+      }
+
+      void add(std::size_t index, std::uint64_t count) {
+        buckets[index] += count;
+        total += count;
+      }
+
+      std::uint64_t count() const {return total;}
+
+      // Upper bound of the bucket holding the p-th percentile (0 to 100).
+      std::uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        std::uint64_t rank = (std::uint64_t)(p / 100 * total);
+        if (rank >= total) rank = total - 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; i++) {
+          seen += buckets[i];
+          if (seen > rank) return highestIn(i);
+        }
+        return highestIn(bucket_count - 1);
+      }
+
+      std::uint64_t max() const {return percentile(100);}
+
+    private:
+      std::array<std::uint64_t, bucket_count> buckets = {};
+      std::uint64_t total = 0;
+    };
+
+    struct ThreadRecord {
+      std::atomic<std::uint64_t> samples{0};
+      std::atomic<std::uint64_t> peaks{0};
+      std::atomic<std::uint64_t> prunes{0};
+      std::atomic<std::uint64_t> alarmsRaised{0};
+      std::atomic<std::uint64_t> alarmsCleared{0};
+      std::atomic<std::uint64_t> batches{0};
+      std::array<std::atomic<std::uint64_t>, LatencyHistogram::bucket_count>
+        batchLatency = {};
+    };
+
+    // Only the owning thread may call this for a given counter.
+    inline void bump(std::atomic<std::uint64_t>& counter, std::uint64_t by) {
+      counter.store(counter.load(std::memory_order_relaxed) + by,
+                    std::memory_order_relaxed);
+    }
+
+    // Records are never freed, so snapshot() still sees the counts of
+    // threads that have finished.
+    class Registry {
+    private:
+      std::mutex lock;
+      std::vector<std::unique_ptr<ThreadRecord>> records;
+
+    public:
+      ThreadRecord* add() {
+        std::lock_guard<std::mutex> guard(lock);
+        records.push_back(std::make_unique<ThreadRecord>());
+        return records.back().get();
+      }
+
+      template <typename Visit>
+      std::size_t forEach(Visit&& visit) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (const auto& record : records) visit(*record);
+        return records.size();
+      }
+    };
+
+    inline Registry& registry() {
+      static Registry instance;
+      return instance;
+    }
+
+    inline ThreadRecord& local() {
+      thread_local ThreadRecord* record = registry().add();
+      return *record;
+    }
+
+    struct Report {
+      Counters counters;
+      LatencyHistogram batchLatency;  // ns per batch call
+      std::size_t threads = 0;
+    };
+
+    inline Report snapshot() {
+      Report report;
+      auto read = [](const std::atomic<std::uint64_t>& counter) {
+        return counter.load(std::memory_order_relaxed);
+      };
+      report.threads = registry().forEach([&](const ThreadRecord& record) {
+        report.counters.samples += read(record.samples);
+        report.counters.peaks += read(record.peaks);
+        report.counters.prunes += read(record.prunes);
+        report.counters.alarmsRaised += read(record.alarmsRaised);
+        report.counters.alarmsCleared += read(record.alarmsCleared);
+        report.counters.batches += read(record.batches);
+        for (std::size_t i = 0; i < LatencyHistogram::bucket_count; i++) {
+          std::uint64_t count = read(record.batchLatency[i]);
+          if (count) report.batchLatency.add(i, count);
+        }
+      });
+      return report;
+    }
+
+    inline void writeText(std::ostream& out, const Report& report) {
+      const Counters& counters = report.counters;
+      const LatencyHistogram& latency = report.batchLatency;
+      out << "threads:        " << report.threads << "\n"
+          << "samples:        " << counters.samples << "\n"
+          << "peaks:          " << counters.peaks << "\n"
+          << "prunes:         " << counters.prunes << "\n"
+          << "alarms raised:  " << counters.alarmsRaised << "\n"
+          << "alarms cleared: " << counters.alarmsCleared << "\n"
+          << "batches:        " << counters.batches << "\n"
+          << "batch latency (ns): p50 " << latency.percentile(50)
+          << " p90 " << latency.percentile(90)
+          << " p99 " << latency.percentile(99)
+          << " p99.9 " << latency.percentile(99.9)
+          << " max " << latency.max() << std::endl;
+    }
+
+    inline void writeJson(std::ostream& out, const Report& report) {
+      const Counters& counters = report.counters;
+      const LatencyHistogram& latency = report.batchLatency;
+      out << "{\"threads\":" << report.threads
+          << ",\"samples\":" << counters.samples
+          << ",\"peaks\":" << counters.peaks
+          << ",\"prunes\":" << counters.prunes
+          << ",\"alarms_raised\":" << counters.alarmsRaised
+          << ",\"alarms_cleared\":" << counters.alarmsCleared
+          << ",\"batches\":" << counters.batches
+          << ",\"batch_latency_ns\":{\"count\":" << latency.count()
+          << ",\"p50\":" << latency.percentile(50)
+          << ",\"p90\":" << latency.percentile(90)
+          << ",\"p99\":" << latency.percentile(99)
+          << ",\"p99_9\":" << latency.percentile(99.9)
+          << ",\"max\":" << latency.max() << "}}" << std::endl;
+    }
+
+    // Tallies the events of one detector call in locals. Built from the
+    // window's peak count and the alarm state before the call; finish()
+    // takes them after it and adds everything to this thread's record.
+    // Prunes are derived from the peak counts, so the windows need no hooks.
+    template <bool Enabled = enabled>
+    class Probe {
+    private:
+      std::uint64_t samples = 0;
+      std::uint64_t peaks = 0;
+      std::uint64_t raised = 0;
+      std::uint64_t cleared = 0;
+      std::size_t peaksBefore;
+      bool timed;
+      std::chrono::steady_clock::time_point start;
+
+    public:
+      void sample(bool isPeak, bool wasActive, bool isActive) {
+        samples++;
+        peaks += isPeak;
+        raised += !wasActive & isActive;
+        cleared += wasActive & !isActive;
+      }
+
+      // samples taken without per-sample checks (no alarm change possible)
+      void skip(std::size_t skipped, std::size_t skippedPeaks) {
+        samples += skipped;
+        peaks += skippedPeaks;
+      }
+
+      void finish(std::size_t peaksAfter) {
+        ThreadRecord& record = local();
+        if (timed) {
+          std::uint64_t ns = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start).count();
+          bump(record.batchLatency[LatencyHistogram::bucketFor(ns)], 1);
+          bump(record.batches, 1);
+        }
+        bump(record.samples, samples);
+        bump(record.peaks, peaks);
+        bump(record.prunes, peaksBefore + peaks - peaksAfter);
+        bump(record.alarmsRaised, raised);
+        bump(record.alarmsCleared, cleared);
+      }
+
+      // timed: this is a batch call, count it and record its latency
+      Probe(std::size_t peaksBefore, bool timed)
+        : peaksBefore(peaksBefore), timed(timed) {
+        if (timed) start = std::chrono::steady_clock::now();
+      }
+    };
+
+    template <>
+    class Probe<false> {
+    public:
+      void sample(bool, bool, bool) {}
+      void skip(std::size_t, std::size_t) {}
+      void finish(std::size_t) {}
+      Probe(std::size_t, bool) {}
+    };
+}
+
+#endif
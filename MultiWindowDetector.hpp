@@ -0,0 +1,153 @@
+// NOTE: README.md contains summary docs
+
+#ifndef MULTI_WINDOW_DETECTOR_HPP
+#define MULTI_WINDOW_DETECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "AlarmThreshold.hpp"
+#include "PeakKernel.hpp"
+
+// One window size and alarm percentage to evaluate.
+struct WindowConfig {
+  unsigned int windowSize;
+  unsigned int alarmPercentage;
+};
+
+// Evaluates several windows (e.g. 100, 1,000 and 100,000 samples, each with
+// its own percentage) over one stream. Peaks are found once and written to a
+// single shared bit history long enough for the largest window; each window
+// only keeps a running count and reads the bit of the sample that just left
+// it, so the cost per sample grows with the number of windows but not with
+// their sizes.
+// Note: up to 64 windows, so their alarm states fit in one mask.
+class MultiWindowAnomalyDetector {
+private:
+  int prevPoint = 0;
+  bool prevIsPossiblePeak = false;
+  std::uint64_t datumNum = 0;
+  std::uint64_t alarmMask = 0;
+
+  // To intern: the history holds at least largest window + 1 bits (rounded
+  // up to a power of two so the index is a mask), so the bit of sample
+  // datumNum - windowSize is still there after writing the current one.
+  std::vector<std::uint64_t> history;
+  std::uint64_t historyMask;
+
+  std::vector<std::uint32_t> windowSizes;
+  std::vector<std::uint32_t> minimumPeaks;
+  std::vector<std::uint32_t> peakCounts;
+
+  bool historyBit(std::uint64_t sample) const {
+    std::uint64_t slot = sample & historyMask;
+    return (history[slot / 64] >> (slot % 64)) & 1;
+  }
+
+  void advance(bool isPeak) {
+    datumNum++;
+    std::uint64_t slot = datumNum & historyMask;
+    std::uint64_t& word = history[slot / 64];
+    word = (word & ~(std::uint64_t(1) << (slot % 64))) |
+           (std::uint64_t(isPeak) << (slot % 64));
+
+    std::uint64_t alarms = 0;
+    for (std::size_t w = 0; w < windowSizes.size(); w++) {
+      std::uint32_t size = windowSizes[w];
+      // before the window has filled this wraps to a slot that has not
+      // been written yet, which reads as 0
+      bool outgoing = historyBit(datumNum - size);
+      peakCounts[w] += (std::uint32_t)isPeak - (std::uint32_t)outgoing;
+
+      bool minDataReceived = datumNum >= size;
+      bool peaksBelowThreshold = peakCounts[w] < minimumPeaks[w];
+      alarms |= std::uint64_t(minDataReceived && peaksBelowThreshold) << w;
+    }
+    alarmMask = alarms;
+  }
+
+public:
+  void processNewDataPoint(int dataPoint) {
+    advance(dataPoint < prevPoint && prevIsPossiblePeak);
+
+    prevIsPossiblePeak = dataPoint > prevPoint && datumNum > 1;
+    prevPoint = dataPoint;
+  }
+
+  // Same contract as AnomalyDetector::processBatch, where "the alarm" means
+  // any of the windows: stops after the first sample that leaves a window in
+  // alarm and returns its index, or data.size() if there was none.
+  std::size_t processBatch(std::span<const int> data) {
+    std::uint64_t peakBits[peak_kernel::block_words];
+    peak_kernel::Carry carry{prevPoint, prevIsPossiblePeak, datumNum > 0};
+
+    for (std::size_t base = 0; base < data.size();
+         base += peak_kernel::block_size) {
+      const int* block = data.data() + base;
+      std::size_t count = data.size() - base < peak_kernel::block_size
+        ? data.size() - base
+        : peak_kernel::block_size;
+      peak_kernel::findPeaks(block, count, carry, peakBits);
+
+      for (std::size_t i = 0; i < count; i++) {
+        advance((peakBits[i / 64] >> (i % 64)) & 1);
+        if (alarmMask) {
+          carry = peak_kernel::carryAfter(block, i, carry);
+          prevPoint = carry.prevPoint;
+          prevIsPossiblePeak = carry.prevIsPossiblePeak;
+          return base + i;
+        }
+      }
+      carry = peak_kernel::carryAfter(block, count - 1, carry);
+    }
+
+    prevPoint = carry.prevPoint;
+    prevIsPossiblePeak = carry.prevIsPossiblePeak;
+    return data.size();
+  }
+
+  // getters
+  // Note: bit w is set while window w (in constructor order) is in alarm.
+  std::uint64_t getAlarmMask() const {return alarmMask;}
+  bool getAlarmActive(std::size_t window) const {
+    return (alarmMask >> window) & 1;
+  }
+  bool getAnyAlarmActive() const {return alarmMask != 0;}
+  std::uint32_t getPeakCount(std::size_t window) const {
+    return peakCounts[window];
+  }
+  std::size_t windowCount() const {return windowSizes.size();}
+  std::uint64_t getDatumNum() const {return datumNum;}
+
+  explicit MultiWindowAnomalyDetector(std::span<const WindowConfig> windows) {
+    if (windows.empty() || windows.size() > 64) {
+      throw std::invalid_argument("between 1 and 64 windows are supported");
+    }
+    std::uint64_t largest = 0;
+    for (const WindowConfig& window : windows) {
+      if (window.windowSize == 0) {
+        throw std::invalid_argument("window size must be at least 1");
+      }
+      windowSizes.push_back(window.windowSize);
+      minimumPeaks.push_back(
+        minimumPeaksFor(window.windowSize, window.alarmPercentage));
+      peakCounts.push_back(0);
+      if (window.windowSize > largest) largest = window.windowSize;
+    }
+
+    std::uint64_t capacity = 64;
+    while (capacity < largest + 1) capacity *= 2;
+    historyMask = capacity - 1;
+    history.assign(capacity / 64, 0);
+  }
+
+  MultiWindowAnomalyDetector(std::initializer_list<WindowConfig> windows)
+    : MultiWindowAnomalyDetector(
+        std::span<const WindowConfig>(windows.begin(), windows.size())) {}
+};
+
+#endif
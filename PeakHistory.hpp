@@ -0,0 +1,165 @@
+// NOTE: README.md contains summary docs
+
+#ifndef PEAK_HISTORY_HPP
+#define PEAK_HISTORY_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#include "PeakKernel.hpp"
+
+// Every peak bit a detector has produced, for questions the window cannot
+// answer once the samples have left it, e.g. "what was the peak rate over
+// samples [a, b)?". Samples are numbered like AlarmEpisode (from 0 over
+// everything the detector consumed).
+//
+// The bits are kept as a rank bitvector in chunks of 65,536 samples: the
+// bits themselves plus the number of peaks before each chunk and before each
+// 512 sample block within it. The peaks before any sample are two table
+// reads and at most eight popcounts, so any range is O(1) however long the
+// history. That costs 1.06 bits per sample, about 133 MB per billion.
+// A finished chunk without a single peak (a flat or monotonic stretch) drops
+// its bits and costs nothing beyond its counts.
+// To intern: appending works a word at a time (the detector hands over each
+// block's peak bitmap once), so recording adds nothing per sample to the
+// batch path.
+class PeakHistory {
+private:
+  static const std::size_t chunk_bits = 1 << 16;
+  static const std::size_t chunk_words = chunk_bits / 64;
+  static const std::size_t block_words = 8;
+
+  struct Chunk {
+    std::uint64_t peaksBefore;
+    std::array<std::uint32_t, chunk_words / block_words> blockPeaks;
+    std::vector<std::uint64_t> words;
+
+    explicit Chunk(std::uint64_t peaksBefore)
+      : peaksBefore(peaksBefore), blockPeaks(), words(chunk_words, 0) {}
+  };
+
+  std::deque<Chunk> chunks;
+  std::uint64_t firstChunk;   // chunk number of chunks.front()
+  std::uint64_t oldest;       // first sample still held
+  std::uint64_t next;         // number of the next sample to be appended
+  std::uint64_t peaks = 0;    // peaks in [firstChunk * chunk_bits, next)
+
+  // Drops the bits of a finished chunk without peaks.
+  void finishChunk() {
+    Chunk& chunk = chunks.back();
+    if (peaks == chunk.peaksBefore) {
+      std::vector<std::uint64_t>().swap(chunk.words);
+    }
+  }
+
+  // Appends count <= 64 bits that do not cross a word of the history.
+  void appendPiece(std::uint64_t bits, std::size_t count) {
+    std::size_t offset = next % chunk_bits;
+    if (offset == 0) chunks.emplace_back(peaks);
+    Chunk& chunk = chunks.back();
+    std::size_t word = offset / 64;
+    if (offset % (block_words * 64) == 0) {
+      chunk.blockPeaks[word / block_words] =
+        (std::uint32_t)(peaks - chunk.peaksBefore);
+    }
+    chunk.words[word] |= bits << (offset % 64);
+    peaks += std::popcount(bits);
+    next += count;
+    if (next % chunk_bits == 0) finishChunk();
+  }
+
+  std::uint64_t rankFrom(std::uint64_t sample) const {
+    if (sample == next) return peaks;
+    const Chunk& chunk = chunks[sample / chunk_bits - firstChunk];
+    if (chunk.words.empty()) return chunk.peaksBefore;
+    std::size_t offset = sample % chunk_bits;
+    std::size_t word = offset / 64;
+    std::size_t block = word / block_words;
+    std::uint64_t rank = chunk.peaksBefore + chunk.blockPeaks[block];
+    for (std::size_t w = block * block_words; w < word; w++) {
+      rank += std::popcount(chunk.words[w]);
+    }
+    std::uint64_t below = (std::uint64_t(1) << (offset % 64)) - 1;
+    return rank + std::popcount(chunk.words[word] & below);
+  }
+
+  void checkRange(std::uint64_t begin, std::uint64_t end) const {
+    if (begin > end || begin < oldest || end > next) {
+      throw std::out_of_range("peak history does not hold that range");
+    }
+  }
+
+public:
+  void append(bool isPeak) {
+    appendPiece(isPeak, 1);
+  }
+
+  // Appends bits first.. first + count of a peak bitmap (LSB first).
+  void append(const std::uint64_t* bits, std::size_t first,
+              std::size_t count) {
+    while (count > 0) {
+      std::size_t piece = 64 - next % 64;
+      if (piece > count) piece = count;
+      appendPiece(peak_kernel::extractBits(bits, first, (unsigned int)piece),
+                  piece);
+      first += piece;
+      count -= piece;
+    }
+  }
+
+  // Peaks among samples [begin, end). Throws std::out_of_range unless
+  // getFirst() <= begin <= end <= getEnd().
+  std::uint64_t peakCount(std::uint64_t begin, std::uint64_t end) const {
+    checkRange(begin, end);
+    return rankFrom(end) - rankFrom(begin);
+  }
+
+  // Percentage of samples in [begin, end) that confirmed a peak, 0 for an
+  // empty range.
+  double peakPercentage(std::uint64_t begin, std::uint64_t end) const {
+    std::uint64_t count = peakCount(begin, end);
+    return begin == end ? 0 : 100.0 * count / (end - begin);
+  }
+
+  // Forgets samples before sample, a whole chunk at a time, so getFirst()
+  // may stay up to 65,535 samples lower.
+  void discardBefore(std::uint64_t sample) {
+    if (sample > next) sample = next;
+    while (!chunks.empty() && (firstChunk + 1) * chunk_bits <= sample) {
+      chunks.pop_front();
+      firstChunk++;
+    }
+    std::uint64_t kept = firstChunk * chunk_bits;
+    if (oldest < kept) oldest = kept;
+  }
+
+  // Heap bytes held by the bits and counts.
+  std::size_t sizeBytes() const {
+    std::size_t bytes = 0;
+    for (const Chunk& chunk : chunks) {
+      bytes += sizeof(Chunk) + chunk.words.capacity() * sizeof(std::uint64_t);
+    }
+    return bytes;
+  }
+
+  // getters
+  std::uint64_t getFirst() const {return oldest;}
+  std::uint64_t getEnd() const {return next;}
+
+  // firstSample: the number of the first sample to be appended, i.e. the
+  // detector's getSamplesConsumed() when the history is attached.
+  explicit PeakHistory(std::uint64_t firstSample = 0)
+    : firstChunk(firstSample / chunk_bits),
+      oldest(firstSample),
+      next(firstSample) {
+    // starting mid chunk, the samples before firstSample count as no peaks
+    if (firstSample % chunk_bits != 0) chunks.emplace_back(0);
+  }
+};
+
+#endif
@@ -0,0 +1,187 @@
+// NOTE: README.md contains summary docs
+
+#ifndef PEAK_KERNEL_HPP
+#define PEAK_KERNEL_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Block-wise peak finding shared by the batch entry points. A sample at
+// position i "confirms" a peak when it is lower than sample i-1 and sample i-1
+// was higher than sample i-2. This is the same rule the streaming detector
+// applies one sample at a time in checkIfPeakCreated.
+// Note: everything is templated on the sample type. int32, int64 and float
+// blocks have SIMD loops; any other type with < and > goes through the
+// scalar loop. Float compares are ordered, so a NaN is never part of a peak,
+// exactly as with the scalar operators.
+namespace peak_kernel
+{
+    // Note: 512 samples keeps the peak bitmap at 8 words on the stack and the
+    // input block (2KB, 4KB for 64 bit samples) comfortably inside L1 while
+    // the window catches up.
+    static const std::size_t block_size = 512;
+    static const std::size_t block_words = block_size / 64;
+
+    // Carried state from the previous block so that the first two samples of
+    // a block can still confirm peaks that straddle the block boundary.
+    template <typename T>
+    struct BasicCarry {
+      T prevPoint;             // last sample seen before this block
+      bool prevIsPossiblePeak; // prevPoint was higher than the one before it
+      bool hasPrevPoint;       // false only before the very first sample
+    };
+
+    using Carry = BasicCarry<int>;
+
+    template <typename T>
+    inline bool isPeakAt(const T* data, std::size_t i,
+                         const BasicCarry<T>& carry) {
+      if (i >= 2) return data[i] < data[i - 1] && data[i - 1] > data[i - 2];
+      if (i == 1) {
+        return data[1] < data[0] && data[0] > carry.prevPoint &&
+               carry.hasPrevPoint;
+      }
+      return data[0] < carry.prevPoint && carry.prevIsPossiblePeak;
+    }
+
+    // Sets bit i (LSB first) of bits for every sample in [begin, end) that
+    // confirms a peak. bits must already be zeroed.
+    template <typename T>
+    inline void findPeaksScalar(const T* data, std::size_t begin,
+                                std::size_t end, const BasicCarry<T>& carry,
+                                std::uint64_t* bits) {
+      for (std::size_t i = begin; i < end; i++) {
+        std::uint64_t peak = isPeakAt(data, i, carry);
+        bits[i / 64] |= peak << (i % 64);
+      }
+    }
+
+    // To intern: the vector loops only start at i = 8 so every load of
+    // data[i - 2] stays inside the block and every lane group lands inside a
+    // single 64 bit word (8, 4 and 2 all divide 64).
+    template <typename T>
+    inline void findPeaks(const T* data, std::size_t count,
+                          const BasicCarry<T>& carry, std::uint64_t* bits) {
+      for (std::size_t w = 0; w < (count + 63) / 64; w++) bits[w] = 0;
+
+      std::size_t head = count < 8 ? count : 8;
+      findPeaksScalar(data, 0, head, carry, bits);
+      std::size_t i = head;
+
+      if constexpr (std::is_same_v<T, std::int32_t>) {
+#if defined(__AVX2__)
+        for (; i + 8 <= count; i += 8) {
+          __m256i before = _mm256_loadu_si256((const __m256i*)(data + i - 2));
+          __m256i middle = _mm256_loadu_si256((const __m256i*)(data + i - 1));
+          __m256i after = _mm256_loadu_si256((const __m256i*)(data + i));
+          __m256i peaks = _mm256_and_si256(_mm256_cmpgt_epi32(middle, before),
+                                           _mm256_cmpgt_epi32(middle, after));
+          std::uint64_t mask =
+              (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(peaks));
+          bits[i / 64] |= mask << (i % 64);
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= count; i += 4) {
+          __m128i before = _mm_loadu_si128((const __m128i*)(data + i - 2));
+          __m128i middle = _mm_loadu_si128((const __m128i*)(data + i - 1));
+          __m128i after = _mm_loadu_si128((const __m128i*)(data + i));
+          __m128i peaks = _mm_and_si128(_mm_cmpgt_epi32(middle, before),
+                                        _mm_cmpgt_epi32(middle, after));
+          std::uint64_t mask =
+              (unsigned)_mm_movemask_ps(_mm_castsi128_ps(peaks));
+          bits[i / 64] |= mask << (i % 64);
+        }
+#endif
+      } else if constexpr (std::is_same_v<T, std::int64_t>) {
+#if defined(__AVX2__)
+        for (; i + 4 <= count; i += 4) {
+          __m256i before = _mm256_loadu_si256((const __m256i*)(data + i - 2));
+          __m256i middle = _mm256_loadu_si256((const __m256i*)(data + i - 1));
+          __m256i after = _mm256_loadu_si256((const __m256i*)(data + i));
+          __m256i peaks = _mm256_and_si256(_mm256_cmpgt_epi64(middle, before),
+                                           _mm256_cmpgt_epi64(middle, after));
+          std::uint64_t mask =
+              (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(peaks));
+          bits[i / 64] |= mask << (i % 64);
+        }
+#elif defined(__SSE4_2__)
+        for (; i + 2 <= count; i += 2) {
+          __m128i before = _mm_loadu_si128((const __m128i*)(data + i - 2));
+          __m128i middle = _mm_loadu_si128((const __m128i*)(data + i - 1));
+          __m128i after = _mm_loadu_si128((const __m128i*)(data + i));
+          __m128i peaks = _mm_and_si128(_mm_cmpgt_epi64(middle, before),
+                                        _mm_cmpgt_epi64(middle, after));
+          std::uint64_t mask =
+              (unsigned)_mm_movemask_pd(_mm_castsi128_pd(peaks));
+          bits[i / 64] |= mask << (i % 64);
+        }
+#endif
+      } else if constexpr (std::is_same_v<T, float>) {
+#if defined(__AVX__)
+        for (; i + 8 <= count; i += 8) {
+          __m256 before = _mm256_loadu_ps(data + i - 2);
+          __m256 middle = _mm256_loadu_ps(data + i - 1);
+          __m256 after = _mm256_loadu_ps(data + i);
+          __m256 peaks =
+            _mm256_and_ps(_mm256_cmp_ps(middle, before, _CMP_GT_OQ),
+                          _mm256_cmp_ps(middle, after, _CMP_GT_OQ));
+          std::uint64_t mask = (unsigned)_mm256_movemask_ps(peaks);
+          bits[i / 64] |= mask << (i % 64);
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= count; i += 4) {
+          __m128 before = _mm_loadu_ps(data + i - 2);
+          __m128 middle = _mm_loadu_ps(data + i - 1);
+          __m128 after = _mm_loadu_ps(data + i);
+          __m128 peaks = _mm_and_ps(_mm_cmpgt_ps(middle, before),
+                                    _mm_cmpgt_ps(middle, after));
+          std::uint64_t mask = (unsigned)_mm_movemask_ps(peaks);
+          bits[i / 64] |= mask << (i % 64);
+        }
+#endif
+      }
+
+      findPeaksScalar(data, i, count, carry, bits);
+    }
+
+    // Carry to hand to the next block after consuming data[0..last].
+    template <typename T>
+    inline BasicCarry<T> carryAfter(const T* data, std::size_t last,
+                                    const BasicCarry<T>& carry) {
+      T before = last > 0 ? data[last - 1] : carry.prevPoint;
+      bool beforeExists = last > 0 || carry.hasPrevPoint;
+      return BasicCarry<T>{data[last], data[last] > before && beforeExists,
+                           true};
+    }
+
+    // Bits first..first + count - 1 (count <= 64) of a findPeaks bitmap,
+    // as the low bits of the result.
+    inline std::uint64_t extractBits(const std::uint64_t* bits,
+                                     std::size_t first, unsigned int count) {
+      unsigned int shift = first % 64;
+      std::uint64_t value = bits[first / 64] >> shift;
+      if (shift + count > 64) value |= bits[first / 64 + 1] << (64 - shift);
+      return count == 64 ? value : value & ((std::uint64_t(1) << count) - 1);
+    }
+
+    // Number of peaks among bits first..first + count - 1.
+    inline std::size_t countBits(const std::uint64_t* bits, std::size_t first,
+                                 std::size_t count) {
+      std::size_t peaks = 0;
+      while (count > 0) {
+        unsigned int piece = count < 64 ? (unsigned int)count : 64;
+        peaks += std::popcount(extractBits(bits, first, piece));
+        first += piece;
+        count -= piece;
+      }
+      return peaks;
+    }
+}
+
+#endif
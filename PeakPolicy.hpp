@@ -0,0 +1,193 @@
+// NOTE: README.md contains summary docs
+
+#ifndef PEAK_POLICY_HPP
+#define PEAK_POLICY_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "PeakKernel.hpp"
+
+// What counts as a peak. A policy is a small stateful object that
+// BasicAnomalyDetector takes as a template parameter, so the choice is made
+// at compile time and each policy's update is straight-line code.
+//
+// Every policy provides:
+//   using Sample
+//       the sample type, which the detector takes on
+//   bool step(Sample dataPoint)
+//       consume one sample, true if it confirms a peak
+//   void findPeaks(const Sample* block, std::size_t count,
+//                  std::uint64_t* bits)
+//       step() over a whole block, bit i set for sample i
+//   void stopAfter(const Sample* block, std::size_t last)
+//       after findPeaks(block, ...), rewind the state to just after
+//       block[last] (used when a batch stops early on an alarm)
+//   bool hasPreviousPoint() const
+//       whether any sample has been consumed yet
+//   saveState(Writer&) const / restoreState(Reader&)
+//       checkpoint support, see Checkpoint.hpp
+
+// The original rule: a sample lower than its predecessor confirms a peak if
+// the predecessor was higher than the sample before it. Plateaus such as
+// 1,3,3,0 never count. Blocks go through the SIMD kernel in PeakKernel.hpp,
+// for any sample type (e.g. BasicStrictPeakPolicy<float>).
+// Note: oldMain.cpp's PeakDetector used the same strict comparison, but over
+// fixed blocks of 100 samples instead of a sliding window.
+template <typename SampleType = int>
+class BasicStrictPeakPolicy {
+private:
+  peak_kernel::BasicCarry<SampleType> carry{SampleType(), false, false};
+  peak_kernel::BasicCarry<SampleType> blockStart{SampleType(), false, false};
+
+public:
+  using Sample = SampleType;
+
+  bool step(Sample dataPoint) {
+    bool isPeak = dataPoint < carry.prevPoint && carry.prevIsPossiblePeak;
+    carry.prevIsPossiblePeak =
+      dataPoint > carry.prevPoint && carry.hasPrevPoint;
+    carry.prevPoint = dataPoint;
+    carry.hasPrevPoint = true;
+    return isPeak;
+  }
+
+  void findPeaks(const Sample* block, std::size_t count,
+                 std::uint64_t* bits) {
+    blockStart = carry;
+    peak_kernel::findPeaks(block, count, carry, bits);
+    carry = peak_kernel::carryAfter(block, count - 1, carry);
+  }
+
+  void stopAfter(const Sample* block, std::size_t last) {
+    carry = peak_kernel::carryAfter(block, last, blockStart);
+  }
+
+  bool hasPreviousPoint() const {return carry.hasPrevPoint;}
+
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(carry.prevPoint);
+    out.put(carry.prevIsPossiblePeak);
+    out.put(carry.hasPrevPoint);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    in.get(carry.prevPoint);
+    in.get(carry.prevIsPossiblePeak);
+    in.get(carry.hasPrevPoint);
+  }
+};
+
+using StrictPeakPolicy = BasicStrictPeakPolicy<>;
+
+// Policy for a rule that has no SIMD kernel. A rule is a Sample type, a State
+// struct and a static update(State&, Sample) returning whether the sample
+// confirms a peak; blocks step() every sample and stopping early replays from
+// the saved block start state.
+template <typename Rule>
+class ScalarPeakPolicy {
+private:
+  typename Rule::State state;
+  typename Rule::State blockStart;
+
+public:
+  using Sample = typename Rule::Sample;
+
+  bool step(Sample dataPoint) {
+    return Rule::update(state, dataPoint);
+  }
+
+  void findPeaks(const Sample* block, std::size_t count,
+                 std::uint64_t* bits) {
+    blockStart = state;
+    for (std::size_t w = 0; w < (count + 63) / 64; w++) bits[w] = 0;
+    for (std::size_t i = 0; i < count; i++) {
+      std::uint64_t isPeak = Rule::update(state, block[i]);
+      bits[i / 64] |= isPeak << (i % 64);
+    }
+  }
+
+  void stopAfter(const Sample* block, std::size_t last) {
+    state = blockStart;
+    for (std::size_t i = 0; i <= last; i++) Rule::update(state, block[i]);
+  }
+
+  bool hasPreviousPoint() const {return state.hasPrevPoint;}
+
+  // Note: the state struct is stored as is, padding included.
+  template <typename Writer>
+  void saveState(Writer& out) const {out.put(state);}
+
+  template <typename Reader>
+  void restoreState(Reader& in) {in.get(state);}
+};
+
+// A flat top counts as one peak: 1,3,3,0 has a peak, confirmed by the 0. A
+// rise followed by a flat run keeps the possible peak alive until the signal
+// moves again; a fall confirms it, a further rise restarts it.
+struct PlateauPeakRule {
+  using Sample = int;
+
+  struct State {
+    int prevPoint = 0;
+    bool possiblePeak = false;
+    bool hasPrevPoint = false;
+  };
+
+  static bool update(State& state, int dataPoint) {
+    bool rising = dataPoint > state.prevPoint;
+    bool flat = dataPoint == state.prevPoint;
+    bool isPeak = (dataPoint < state.prevPoint) & state.possiblePeak;
+    state.possiblePeak =
+      state.hasPrevPoint & (rising | (flat & state.possiblePeak));
+    state.prevPoint = dataPoint;
+    state.hasPrevPoint = true;
+    return isPeak;
+  }
+};
+
+using PlateauPeakPolicy = ScalarPeakPolicy<PlateauPeakRule>;
+
+// Hysteresis: a peak needs the signal to rise at least Delta above the last
+// trough and then fall at least Delta below the highest point since. Small
+// wiggles (noise) are ignored. The peak is confirmed by the sample that
+// completes the fall. The stream starts out looking for a trough.
+template <int Delta>
+struct ProminencePeakRule {
+  static_assert(Delta > 0, "prominence must be positive");
+
+  using Sample = int;
+
+  struct State {
+    std::int64_t extreme = 0; // highest point when seeking a peak, else lowest
+    bool seekingPeak = false;
+    bool hasPrevPoint = false;
+  };
+
+  // To intern: both outcomes are computed and the right one selected, which
+  // compiles to conditional moves instead of branches.
+  static bool update(State& state, int dataPoint) {
+    std::int64_t value = dataPoint;
+    std::int64_t extreme = state.hasPrevPoint ? state.extreme : value;
+
+    std::int64_t highest = value > extreme ? value : extreme;
+    std::int64_t lowest = value < extreme ? value : extreme;
+    bool fell = value <= highest - Delta;
+    bool rose = value >= lowest + Delta;
+
+    bool isPeak = state.seekingPeak & fell;
+    std::int64_t whenSeekingPeak = fell ? value : highest;
+    std::int64_t whenSeekingTrough = rose ? value : lowest;
+    state.extreme = state.seekingPeak ? whenSeekingPeak : whenSeekingTrough;
+    state.seekingPeak = state.seekingPeak ? !fell : rose;
+    state.hasPrevPoint = true;
+    return isPeak;
+  }
+};
+
+template <int Delta>
+using ProminencePeakPolicy = ScalarPeakPolicy<ProminencePeakRule<Delta>>;
+
+#endif
@@ -0,0 +1,388 @@
+// NOTE: README.md contains summary docs
+
+#ifndef PEAK_WINDOW_HPP
+#define PEAK_WINDOW_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "PeakKernel.hpp"
+
+// Sliding window storage for AnomalyDetector. A window is told about every
+// sample via slide(datumNum, isPeak) after datumNum has been incremented and
+// keeps peakCount() equal to the number of peaks confirmed within the last
+// windowSize samples (the current one included).
+
+// To intern: only storing relevant peaks saves space and time (constant time
+// insertion/deletion at front and back).
+// Note: the deque stores the low 32 bits of the sample numbers and only ever
+// compares distances, which stay below windowSize, so it works with any
+// counter width. It still needs rebase() when the detector renumbers a
+// wrapped counter, and allocates as peaks are pushed.
+class DequePeakWindow {
+private:
+  std::deque<unsigned int> peaksInWindow;
+  unsigned int windowSize;
+
+public:
+  // To intern: if peak falls outside of window it is no longer relevant so we
+  // delete it from our queue. Always check empty() before back(), the deque
+  // can legitimately run dry during a flat stretch of data.
+  // Note: the implementation here is nice because we could easily change the
+  // code to instead work on the last 100 seconds of datapoints instead of just
+  // the last 100 datapoints. The pruning would be time based as would the
+  // inserting of peaks (TimeWindowDetector.hpp does this with time buckets).
+  void slide(std::uint64_t datumNum, bool isPeak) {
+    unsigned int current = (unsigned int)datumNum;
+    while (!peaksInWindow.empty() &&
+           current - peaksInWindow.back() >= windowSize) {
+      peaksInWindow.pop_back();
+    }
+    if (isPeak) peaksInWindow.push_front(current);
+  }
+
+  // To intern: resetting all time step vals but keeping relative order
+  void rebase(std::uint64_t offset) {
+    for (std::size_t i = 0; i < peaksInWindow.size(); i++) {
+      peaksInWindow[i] -= (unsigned int)offset;
+    }
+  }
+
+  std::size_t peakCount() const {return peaksInWindow.size();}
+
+  // Checkpoint support, see Checkpoint.hpp.
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(windowSize);
+    out.put(std::uint64_t(peaksInWindow.size()));
+    for (unsigned int peak : peaksInWindow) out.put(peak);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    in.expect(windowSize, "window size");
+    std::uint64_t count;
+    in.get(count);
+    peaksInWindow.clear();
+    for (std::uint64_t i = 0; i < count; i++) {
+      unsigned int peak;
+      in.get(peak);
+      peaksInWindow.push_back(peak);
+    }
+  }
+
+  DequePeakWindow(unsigned int windowSize) : windowSize(windowSize) {}
+};
+
+// Optional: slideBlock(bits, first, count) takes count samples at once, the
+// peak bits first.. of a peak_kernel::findPeaks bitmap. The detector uses it
+// to skip ahead while no alarm is possible (see samplesWithoutAlarm).
+
+namespace bit_ring
+{
+    // Writes count bits of a peak bitmap into a ring of windowSize bits at
+    // position, adjusting peaks by the bits coming in and going out. Works a
+    // word at a time: each piece ends at a word boundary of either bitmap or
+    // at the end of the ring.
+    inline void slideBlock(std::uint64_t* ring, unsigned int windowSize,
+                           unsigned int& position, unsigned int& peaks,
+                           const std::uint64_t* bits, std::size_t first,
+                           std::size_t count) {
+      while (count > 0) {
+        unsigned int shift = position % 64;
+        std::size_t piece = 64 - shift;
+        if (piece > 64 - first % 64) piece = 64 - first % 64;
+        if (piece > windowSize - position) piece = windowSize - position;
+        if (piece > count) piece = count;
+
+        std::uint64_t mask = piece == 64
+          ? ~std::uint64_t(0)
+          : ((std::uint64_t(1) << piece) - 1);
+        std::uint64_t incoming =
+          peak_kernel::extractBits(bits, first, (unsigned int)piece);
+        std::uint64_t& word = ring[position / 64];
+        std::uint64_t outgoing = (word >> shift) & mask;
+
+        peaks += std::popcount(incoming) - std::popcount(outgoing);
+        word = (word & ~(mask << shift)) | (incoming << shift);
+        position += piece;
+        if (position == windowSize) position = 0;
+        first += piece;
+        count -= piece;
+      }
+    }
+
+    // Checks a restored ring: peaks has to be the number of bits set, and
+    // the bits past windowSize in the last word have to be clear.
+    inline void checkRestored(const std::uint64_t* ring,
+                              unsigned int windowSize, unsigned int peaks) {
+      std::size_t words = (windowSize + 63) / 64;
+      std::size_t set = 0;
+      for (std::size_t w = 0; w < words; w++) set += std::popcount(ring[w]);
+      std::uint64_t last = ring[words - 1];
+      if (windowSize % 64 != 0) last >>= windowSize % 64;
+      else last = 0;
+      if (set != peaks || last != 0) {
+        throw std::runtime_error("checkpoint's peak count does not match its "
+                                 "window");
+      }
+    }
+}
+
+// Ring of windowSize bits (one per sample) plus a running peak count. Each
+// slide overwrites the bit of the sample that just left the window, so the
+// update is O(1), never allocates and does not care about absolute sample
+// numbers (rebase() is a no-op).
+// Note: windows up to 128 samples are stored inline, which keeps a whole
+// detector with the default window of 100 inside two cache lines. Larger
+// windows allocate once, in the constructor.
+class BitRingPeakWindow {
+private:
+  static const unsigned int inline_words = 2;
+
+  std::uint64_t inlineBits[inline_words] = {};
+  std::vector<std::uint64_t> heapBits;
+  unsigned int windowSize;
+  unsigned int position = 0;
+  unsigned int peaks = 0;
+
+  std::uint64_t* bits() {
+    return heapBits.empty() ? inlineBits : heapBits.data();
+  }
+  const std::uint64_t* bits() const {
+    return heapBits.empty() ? inlineBits : heapBits.data();
+  }
+
+public:
+  void slide(std::uint64_t, bool isPeak) {
+    std::uint64_t& word = bits()[position / 64];
+    unsigned int shift = position % 64;
+    std::uint64_t incoming = isPeak;
+    std::uint64_t outgoing = (word >> shift) & 1;
+
+    peaks += incoming - outgoing;
+    word = (word & ~(std::uint64_t(1) << shift)) | (incoming << shift);
+    position = position + 1 == windowSize ? 0 : position + 1;
+  }
+
+  void slideBlock(const std::uint64_t* peakBits, std::size_t first,
+                  std::size_t count) {
+    bit_ring::slideBlock(bits(), windowSize, position, peaks, peakBits, first,
+                         count);
+  }
+
+  void rebase(std::uint64_t) {}
+
+  std::size_t peakCount() const {return peaks;}
+
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(windowSize);
+    out.put(position);
+    out.put(peaks);
+    out.putArray(bits(), (windowSize + 63) / 64);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    in.expect(windowSize, "window size");
+    in.get(position);
+    if (position >= windowSize) {
+      throw std::runtime_error("checkpoint has a bad window position");
+    }
+    in.get(peaks);
+    in.getArray(bits(), (windowSize + 63) / 64);
+    bit_ring::checkRestored(bits(), windowSize, peaks);
+  }
+
+  BitRingPeakWindow(unsigned int windowSize) : windowSize(windowSize) {
+    if (windowSize == 0) {
+      throw std::invalid_argument("window size must be at least 1");
+    }
+    std::size_t words = (windowSize + 63) / 64;
+    if (words > inline_words) heapBits.assign(words, 0);
+  }
+};
+
+// Bit ring like BitRingPeakWindow over storage owned by someone else, e.g.
+// one slot of DetectorFleet's arena. The storage must hold
+// words(windowSize) zeroed words and outlive the window.
+class ArenaPeakWindow {
+private:
+  std::uint64_t* ring;
+  unsigned int windowSize;
+  unsigned int position = 0;
+  unsigned int peaks = 0;
+
+public:
+  static std::size_t words(unsigned int windowSize) {
+    return (windowSize + 63) / 64;
+  }
+
+  void slide(std::uint64_t, bool isPeak) {
+    std::uint64_t& word = ring[position / 64];
+    unsigned int shift = position % 64;
+    std::uint64_t incoming = isPeak;
+    std::uint64_t outgoing = (word >> shift) & 1;
+
+    peaks += incoming - outgoing;
+    word = (word & ~(std::uint64_t(1) << shift)) | (incoming << shift);
+    position = position + 1 == windowSize ? 0 : position + 1;
+  }
+
+  void slideBlock(const std::uint64_t* peakBits, std::size_t first,
+                  std::size_t count) {
+    bit_ring::slideBlock(ring, windowSize, position, peaks, peakBits, first,
+                         count);
+  }
+
+  void rebase(std::uint64_t) {}
+
+  std::size_t peakCount() const {return peaks;}
+  unsigned int getWindowSize() const {return windowSize;}
+
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(windowSize);
+    out.put(position);
+    out.put(peaks);
+    out.putArray(ring, words(windowSize));
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    in.expect(windowSize, "window size");
+    in.get(position);
+    if (position >= windowSize) {
+      throw std::runtime_error("checkpoint has a bad window position");
+    }
+    in.get(peaks);
+    in.getArray(ring, words(windowSize));
+    bit_ring::checkRestored(ring, windowSize, peaks);
+  }
+
+  ArenaPeakWindow(std::uint64_t* storage, unsigned int windowSize)
+    : ring(storage), windowSize(windowSize) {
+    if (windowSize == 0) {
+      throw std::invalid_argument("window size must be at least 1");
+    }
+  }
+};
+
+// Window whose size is a template parameter. Up to 64 (or 128 where the
+// compiler has a 128 bit integer) samples it is a single shift register: the
+// new bit goes in at the bottom and the bit shifted past WindowSize - 1 is the
+// sample leaving the window. Larger windows use a statically sized bit ring.
+template <unsigned int WindowSize, typename Enable = void>
+class StaticPeakWindow {
+private:
+  std::array<std::uint64_t, (WindowSize + 63) / 64> bits = {};
+  unsigned int position = 0;
+  unsigned int peaks = 0;
+
+public:
+  void slide(std::uint64_t, bool isPeak) {
+    std::uint64_t& word = bits[position / 64];
+    unsigned int shift = position % 64;
+    std::uint64_t incoming = isPeak;
+    std::uint64_t outgoing = (word >> shift) & 1;
+
+    peaks += incoming - outgoing;
+    word = (word & ~(std::uint64_t(1) << shift)) | (incoming << shift);
+    position = position + 1 == WindowSize ? 0 : position + 1;
+  }
+
+  void slideBlock(const std::uint64_t* peakBits, std::size_t first,
+                  std::size_t count) {
+    bit_ring::slideBlock(bits.data(), WindowSize, position, peaks, peakBits,
+                         first, count);
+  }
+
+  void rebase(std::uint64_t) {}
+
+  std::size_t peakCount() const {return peaks;}
+
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(position);
+    out.put(peaks);
+    out.put(bits);
+  }
+
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    in.get(position);
+    if (position >= WindowSize) {
+      throw std::runtime_error("checkpoint has a bad window position");
+    }
+    in.get(peaks);
+    in.get(bits);
+    bit_ring::checkRestored(bits.data(), WindowSize, peaks);
+  }
+};
+
+#if defined(__SIZEOF_INT128__)
+#define PEAK_WINDOW_REGISTER_BITS 128
+#else
+#define PEAK_WINDOW_REGISTER_BITS 64
+#endif
+
+template <unsigned int WindowSize>
+class StaticPeakWindow<WindowSize, std::enable_if_t<(
+    WindowSize > 0 && WindowSize <= PEAK_WINDOW_REGISTER_BITS)>> {
+private:
+#if defined(__SIZEOF_INT128__)
+  using Register = std::conditional_t<(WindowSize <= 64), std::uint64_t,
+                                      unsigned __int128>;
+#else
+  using Register = std::uint64_t;
+#endif
+
+  Register history = 0;
+  unsigned int peaks = 0;
+
+public:
+  void slide(std::uint64_t, bool isPeak) {
+    unsigned int outgoing = (unsigned int)(history >> (WindowSize - 1)) & 1;
+    history = (history << 1) | Register(isPeak);
+    peaks += (unsigned int)isPeak - outgoing;
+  }
+
+  void rebase(std::uint64_t) {}
+
+  std::size_t peakCount() const {return peaks;}
+
+  template <typename Writer>
+  void saveState(Writer& out) const {
+    out.put(history);
+    out.put(peaks);
+  }
+
+  // Note: bits above WindowSize are samples that already left the window,
+  // so only the bits below it have to add up to peaks.
+  template <typename Reader>
+  void restoreState(Reader& in) {
+    in.get(history);
+    in.get(peaks);
+    Register inWindow = history;
+    if constexpr (WindowSize < sizeof(Register) * 8) {
+      inWindow &= (Register(1) << WindowSize) - 1;
+    }
+    unsigned int set = std::popcount((std::uint64_t)inWindow);
+    if constexpr (sizeof(Register) > 8) {
+      set += std::popcount((std::uint64_t)(inWindow >> 64));
+    }
+    if (set != peaks) {
+      throw std::runtime_error("checkpoint's peak count does not match its "
+                               "window");
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,273 @@
+// NOTE: README.md contains summary docs
+
+#ifndef REORDER_BUFFER_HPP
+#define REORDER_BUFFER_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// What to do about a sequence number that has not arrived once a later
+// sample no longer fits in the buffer (or on flush()).
+enum class GapPolicy {
+  wait,         // keep waiting: drop the sample that does not fit instead
+  skip,         // give up on it, the detector sees its neighbours back to back
+  interpolate   // give up on it and fill it in from its neighbours
+};
+
+struct ReorderCounters {
+  std::uint64_t received = 0;
+  std::uint64_t reordered = 0;    // accepted after a higher sequence number
+  std::uint64_t late = 0;         // its sequence number was already passed
+  std::uint64_t duplicates = 0;   // its sequence number was already held
+  std::uint64_t overflowed = 0;   // too far ahead of a gap (wait only)
+  std::uint64_t skipped = 0;      // missing samples given up on
+  std::uint64_t interpolated = 0; // missing samples filled in
+
+  std::uint64_t dropped() const {return late + duplicates + overflowed;}
+};
+
+// Puts sequence numbered samples (e.g. from a UDP feed) back in order for a
+// detector, whose peak finding assumes each sample follows the previous one.
+// Samples that arrive ahead of a gap are held in a ring of capacity slots
+// indexed by sequence number mod capacity until the gap is filled; samples
+// that are in order are collected into a run, handed to onRun (as a
+// std::span<const Sample>, typically straight into scanBatch) once it holds
+// runSize samples or when the caller calls release().
+// A gap is given up on when a sample arrives capacity or more sequence
+// numbers after it, or on flush(); see GapPolicy. A sample whose sequence
+// number was already released or given up on counts as late and is dropped.
+// Note: all storage is allocated by the constructor, push() never allocates.
+// onRun may be called from push() (run full, gap given up on), release() and
+// flush(), and must be done with the span when it returns.
+template <typename Sample = int>
+class ReorderBuffer {
+private:
+  std::vector<Sample> slots;
+  std::vector<unsigned char> held;
+  std::vector<Sample> run;
+  std::size_t runLength = 0;
+  std::size_t mask;
+  GapPolicy policy;
+
+  std::uint64_t next;       // first sequence number not yet in run
+  std::uint64_t highest;    // one past the highest sequence number accepted
+  std::size_t pending = 0;  // samples held in slots
+  std::uint64_t outageEnd;  // missing samples below this are skipped
+  Sample lastReleased = Sample();
+  bool released = false;
+  ReorderCounters counters;
+
+  static Sample between(Sample left, Sample right, std::uint64_t step,
+                        std::uint64_t steps) {
+    double value = left + ((double)right - (double)left) * step / steps;
+    if constexpr (std::is_integral_v<Sample>) {
+      return (Sample)std::llround(value);
+    } else {
+      return (Sample)value;
+    }
+  }
+
+  // To intern: run is a fixed array of runSize samples, handed over as soon
+  // as it is full, so the in order path is a store and two increments.
+  template <typename OnRun>
+  void append(Sample value, OnRun& onRun) {
+    run[runLength++] = value;
+    next++;
+    if (runLength == run.size()) release(onRun);
+  }
+
+  // Moves held samples that are now in order into run, a stretch (up to the
+  // end of the ring or of the run) at a time.
+  template <typename OnRun>
+  void collect(OnRun& onRun) {
+    while (pending > 0 && held[next & mask]) {
+      std::size_t slot = next & mask;
+      std::size_t room = run.size() - runLength;
+      if (room > slots.size() - slot) room = slots.size() - slot;
+      if (room > pending) room = pending;
+
+      std::size_t count = 0;
+      while (count < room && held[slot + count]) {
+        held[slot + count] = 0;
+        run[runLength + count] = slots[slot + count];
+        count++;
+      }
+      runLength += count;
+      next += count;
+      pending -= count;
+      if (runLength == run.size()) release(onRun);
+    }
+  }
+
+  // Gives up on the missing samples from next up to limit, or up to the
+  // first held sample if that comes first. The gap runs from next to the
+  // first held sample or, if nothing is held, to end.
+  // An interpolated gap is filled up to its end in one go, so every value
+  // lies on the same line.
+  template <typename OnRun>
+  void giveUp(std::uint64_t limit, std::uint64_t end, OnRun& onRun) {
+    if (pending > 0) {
+      end = next + 1;
+      while (!held[end & mask]) end++;
+    }
+    std::uint64_t gap = end - next;
+
+    // Note: a gap as long as the buffer is an outage (or a restarted sender),
+    // not a few lost packets, and is skipped even when interpolating, up to
+    // the sample that ended it.
+    if (gap >= slots.size()) outageEnd = end;
+    if (policy == GapPolicy::interpolate && next >= outageEnd) {
+      // gap < capacity, so it ends at a held sample
+      Sample right = slots[end & mask];
+      Sample left = runLength > 0 ? run[runLength - 1]
+                    : released ? lastReleased : right;
+      for (std::uint64_t step = 1; step <= gap; step++) {
+        append(between(left, right, step, gap + 1), onRun);
+      }
+      counters.interpolated += gap;
+    } else {
+      if (limit > end) limit = end;
+      counters.skipped += limit - next;
+      next = limit;
+    }
+    collect(onRun);
+  }
+
+public:
+  template <typename OnRun>
+  void push(std::uint64_t sequence, Sample value, OnRun&& onRun) {
+    counters.received++;
+    if (sequence < next) {
+      counters.late++;
+      return;
+    }
+    if (sequence - next >= slots.size()) {
+      if (policy == GapPolicy::wait) {
+        counters.overflowed++;
+        return;
+      }
+      // only what has to go for sequence to fit: samples just behind it
+      // may still be on their way
+      while (sequence - next >= slots.size()) {
+        giveUp(sequence - slots.size() + 1, sequence, onRun);
+      }
+    }
+
+    if (sequence == next) {
+      counters.reordered += sequence < highest;
+      if (sequence >= highest) highest = sequence + 1;
+      append(value, onRun);
+      collect(onRun);
+      return;
+    }
+    std::size_t slot = sequence & mask;
+    if (held[slot]) {
+      counters.duplicates++;
+      return;
+    }
+    counters.reordered += sequence < highest;
+    if (sequence >= highest) highest = sequence + 1;
+    slots[slot] = value;
+    held[slot] = 1;
+    pending++;
+  }
+
+  // Samples firstSequence, firstSequence + 1, ... at once, e.g. a datagram
+  // that carries consecutive samples. Copied straight into the run when they
+  // are next in line and nothing is held, into the ring when they fit ahead
+  // of a gap, one push() per sample otherwise.
+  template <typename OnRun>
+  void push(std::uint64_t firstSequence, std::span<const Sample> values,
+            OnRun&& onRun) {
+    std::uint64_t end = firstSequence + values.size();
+    if (firstSequence > next && end - next <= slots.size()) {
+      counters.received += values.size();
+      for (std::size_t i = 0; i < values.size(); i++) {
+        std::uint64_t sequence = firstSequence + i;
+        std::size_t slot = sequence & mask;
+        if (held[slot]) {
+          counters.duplicates++;
+          continue;
+        }
+        counters.reordered += sequence < highest;
+        slots[slot] = values[i];
+        held[slot] = 1;
+        pending++;
+      }
+      if (end > highest) highest = end;
+      return;
+    }
+    if (firstSequence != next || pending > 0) {
+      for (std::size_t i = 0; i < values.size(); i++) {
+        push(firstSequence + i, values[i], onRun);
+      }
+      return;
+    }
+    counters.received += values.size();
+    highest = next + values.size();
+    while (!values.empty()) {
+      std::size_t count = run.size() - runLength;
+      if (count > values.size()) count = values.size();
+      std::copy(values.begin(), values.begin() + count,
+                run.begin() + runLength);
+      runLength += count;
+      next += count;
+      values = values.subspan(count);
+      if (runLength == run.size()) release(onRun);
+    }
+  }
+
+  // Hands the samples collected so far to onRun without waiting for any
+  // gap, e.g. at the end of every datagram.
+  template <typename OnRun>
+  void release(OnRun&& onRun) {
+    if (runLength == 0) return;
+    onRun(std::span<const Sample>(run.data(), runLength));
+    lastReleased = run[runLength - 1];
+    released = true;
+    runLength = 0;
+  }
+
+  // End of the stream (or of the caller's patience): gives up on every gap
+  // below the highest sequence number accepted, skipping them under
+  // GapPolicy::wait, and releases everything.
+  template <typename OnRun>
+  void flush(OnRun&& onRun) {
+    while (pending > 0) giveUp(highest, highest, onRun);
+    release(onRun);
+  }
+
+  // getters
+  const ReorderCounters& getCounters() const {return counters;}
+  std::uint64_t getNextSequence() const {return next;}
+  std::size_t getHeld() const {return pending;}
+  std::size_t capacity() const {return slots.size();}
+
+  // capacity is rounded up to a power of two. firstSequence is the sequence
+  // number of the first sample of the stream. Throws std::invalid_argument
+  // for a capacity or run size of 0.
+  ReorderBuffer(std::size_t capacity, GapPolicy policy = GapPolicy::wait,
+                std::uint64_t firstSequence = 0, std::size_t runSize = 1024)
+    : slots(std::bit_ceil(capacity)),
+      held(slots.size(), 0),
+      run(runSize),
+      mask(slots.size() - 1),
+      policy(policy),
+      next(firstSequence),
+      highest(firstSequence),
+      outageEnd(firstSequence) {
+    if (capacity == 0 || runSize == 0) {
+      throw std::invalid_argument(
+        "reorder buffer needs a capacity and run size");
+    }
+  }
+};
+
+#endif
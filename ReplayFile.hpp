@@ -0,0 +1,139 @@
+// NOTE: README.md contains summary docs
+
+#ifndef REPLAY_FILE_HPP
+#define REPLAY_FILE_HPP
+
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Captured sample files for incident replays. Two formats are supported:
+//   * raw:    little-endian int32 per sample, mapped and read in place
+//   * varint: zigzag LEB128 encoded difference to the previous sample
+//             (the first sample is relative to 0), decoded in blocks
+// Note: POSIX only (mmap/madvise). Files are mapped read-only and the kernel
+// is told the access is sequential so it reads ahead aggressively and drops
+// pages behind us.
+
+// To intern: RAII keeps the mapping and the descriptor from leaking on the
+// error paths; throwing from the constructor means there is never a
+// half-open file to check for.
+class MappedFile {
+private:
+  void* address = nullptr;
+  std::size_t length = 0;
+
+public:
+  std::span<const unsigned char> bytes() const {
+    return {static_cast<const unsigned char*>(address), length};
+  }
+
+  // Raw format view. The mapping is page aligned, so it can be used as ints
+  // directly on little-endian hosts; a trailing partial sample is ignored.
+  std::span<const int> samples() const {
+    static_assert(std::endian::native == std::endian::little,
+                  "raw replay files are little-endian int32");
+    return {static_cast<const int*>(address), length / sizeof(int)};
+  }
+
+  explicit MappedFile(const std::string& path) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+      throw std::runtime_error("cannot open " + path + ": " +
+                               std::strerror(errno));
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) != 0) {
+      close(descriptor);
+      throw std::runtime_error("cannot stat " + path);
+    }
+
+    length = info.st_size;
+    if (length > 0) {
+      address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+      if (address == MAP_FAILED) {
+        address = nullptr;
+        close(descriptor);
+        throw std::runtime_error("cannot map " + path + ": " +
+                                 std::strerror(errno));
+      }
+      madvise(address, length, MADV_SEQUENTIAL);
+    }
+    close(descriptor);
+  }
+
+  ~MappedFile() {
+    if (address) munmap(address, length);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+};
+
+namespace varint_delta
+{
+    inline void encode(int value, int& previous,
+                       std::vector<unsigned char>& out) {
+      std::uint32_t delta = std::uint32_t(value) - std::uint32_t(previous);
+      std::uint32_t zigzag = (delta << 1) ^ -(delta >> 31);
+      while (zigzag >= 0x80) {
+        out.push_back((unsigned char)(zigzag | 0x80));
+        zigzag >>= 7;
+      }
+      out.push_back((unsigned char)zigzag);
+      previous = value;
+    }
+
+    // Decodes the input a block at a time into caller provided storage.
+    class Decoder {
+    private:
+      std::span<const unsigned char> input;
+      std::size_t position = 0;
+      std::uint32_t previous = 0;
+
+    public:
+      // Fills out with up to out.size() samples and returns how many were
+      // decoded (0 at the end of the input). A truncated last sample is
+      // dropped.
+      std::size_t decode(std::span<int> out) {
+        std::size_t count = 0;
+        while (count < out.size() && position < input.size()) {
+          std::uint32_t zigzag = 0;
+          unsigned int shift = 0;
+          std::size_t cursor = position;
+          unsigned char byte;
+          do {
+            if (cursor == input.size() || shift > 28) {
+              position = input.size();
+              return count;
+            }
+            byte = input[cursor++];
+            zigzag |= std::uint32_t(byte & 0x7f) << shift;
+            shift += 7;
+          } while (byte & 0x80);
+
+          position = cursor;
+          previous += (zigzag >> 1) ^ -(zigzag & 1);
+          out[count++] = (int)previous;
+        }
+        return count;
+      }
+
+      std::size_t bytesConsumed() const {return position;}
+
+      explicit Decoder(std::span<const unsigned char> input) : input(input) {}
+    };
+}
+
+#endif
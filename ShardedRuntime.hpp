@@ -0,0 +1,222 @@
+// NOTE: README.md contains summary docs
+
+#ifndef SHARDED_RUNTIME_HPP
+#define SHARDED_RUNTIME_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "AnomalyDetector.hpp"
+
+// Runs one RingAnomalyDetector per channel on a pool of worker threads.
+// Channels are grouped into shards and every worker owns a queue of shards.
+// Work is handed over in rounds: processRound() receives the next slice of
+// samples for every channel, each worker drains its own queue and then steals
+// shards from the back of the other queues, so a worker stuck with hot
+// channels gets help from the idle ones.
+// Note: a shard is claimed by exactly one worker per round and its detectors
+// are only ever touched by that worker, so the per-sample path has no locks
+// or atomics. The only synchronisation is one CAS per shard claimed and the
+// round start/finish handshake. Since every channel is still processed in
+// order by a single thread the results per channel do not depend on the
+// number of threads.
+class ShardedAnomalyRuntime {
+public:
+  static const std::uint64_t no_alarm = UINT64_MAX;
+
+  struct ChannelReport {
+    std::uint64_t samples = 0;
+    std::uint64_t alarmSamples = 0;
+    std::uint64_t firstAlarm = no_alarm; // sample number, 1 based
+
+    bool operator==(const ChannelReport&) const = default;
+  };
+
+private:
+  struct Shard {
+    std::size_t firstChannel;
+    std::vector<RingAnomalyDetector> detectors;
+  };
+
+  // To intern: head (claimed from the front by the owner) and tail (claimed
+  // from the back by thieves) share one atomic word so both ends can be
+  // claimed with a single compare-exchange. alignas keeps each queue on its
+  // own cache line.
+  struct alignas(64) WorkQueue {
+    std::atomic<std::uint64_t> bounds{0};
+    std::vector<std::uint32_t> shards;
+  };
+
+  std::vector<Shard> shards;
+  std::vector<ChannelReport> reports;
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::vector<std::thread> workers;
+  std::span<const std::span<const int>> input;
+
+  std::mutex roundMutex;
+  std::condition_variable roundStart;
+  std::condition_variable roundDone;
+  std::uint64_t round = 0;
+  unsigned int busyWorkers = 0;
+  bool stopping = false;
+
+  static bool claimFront(WorkQueue& queue, std::uint32_t& shard) {
+    std::uint64_t bounds = queue.bounds.load(std::memory_order_acquire);
+    while ((bounds >> 32) < (std::uint32_t)bounds) {
+      if (queue.bounds.compare_exchange_weak(bounds, bounds + (1ull << 32),
+                                             std::memory_order_acq_rel)) {
+        shard = queue.shards[bounds >> 32];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool claimBack(WorkQueue& queue, std::uint32_t& shard) {
+    std::uint64_t bounds = queue.bounds.load(std::memory_order_acquire);
+    while ((bounds >> 32) < (std::uint32_t)bounds) {
+      if (queue.bounds.compare_exchange_weak(bounds, bounds - 1,
+                                             std::memory_order_acq_rel)) {
+        shard = queue.shards[(std::uint32_t)bounds - 1];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void processShard(Shard& shard) {
+    for (std::size_t i = 0; i < shard.detectors.size(); i++) {
+      RingAnomalyDetector& detector = shard.detectors[i];
+      ChannelReport& report = reports[shard.firstChannel + i];
+      std::span<const int> samples = input[shard.firstChannel + i];
+
+      std::size_t position = 0;
+      while (position < samples.size()) {
+        std::size_t alarmAt = detector.processBatch(samples.subspan(position));
+        if (position + alarmAt == samples.size()) break;
+
+        report.alarmSamples++;
+        if (report.firstAlarm == no_alarm) {
+          report.firstAlarm = report.samples + position + alarmAt + 1;
+        }
+        position += alarmAt + 1;
+
+        // To intern: while the alarm holds, every sample would end a batch,
+        // so step one sample at a time until it clears.
+        while (position < samples.size() && detector.getAlarmActive()) {
+          detector.processNewDataPoint(samples[position++]);
+          report.alarmSamples += detector.getAlarmActive();
+        }
+      }
+      report.samples += samples.size();
+    }
+  }
+
+  void drain(std::size_t self) {
+    std::uint32_t shard;
+    while (claimFront(*queues[self], shard)) processShard(shards[shard]);
+    for (std::size_t k = 1; k < queues.size(); k++) {
+      WorkQueue& victim = *queues[(self + k) % queues.size()];
+      while (claimBack(victim, shard)) processShard(shards[shard]);
+    }
+  }
+
+  void workerLoop(std::size_t self) {
+    std::uint64_t seenRound = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(roundMutex);
+        roundStart.wait(lock, [&] {return stopping || round != seenRound;});
+        if (stopping) return;
+        seenRound = round;
+      }
+      drain(self);
+      {
+        std::lock_guard<std::mutex> lock(roundMutex);
+        if (--busyWorkers == 0) roundDone.notify_one();
+      }
+    }
+  }
+
+public:
+  // Feeds channelSamples[c] (any length, possibly empty) to channel c and
+  // blocks until every channel has consumed its slice. The calling thread
+  // takes part as worker 0.
+  void processRound(std::span<const std::span<const int>> channelSamples) {
+    input = channelSamples;
+    for (auto& queue : queues) {
+      queue->bounds.store(queue->shards.size(), std::memory_order_relaxed);
+    }
+    {
+      std::lock_guard<std::mutex> lock(roundMutex);
+      busyWorkers = workers.size();
+      round++;
+    }
+    roundStart.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(roundMutex);
+    roundDone.wait(lock, [&] {return busyWorkers == 0;});
+  }
+
+  // getters
+  const ChannelReport& getReport(std::size_t channel) const {
+    return reports[channel];
+  }
+  std::span<const ChannelReport> getReports() const {return reports;}
+  std::size_t channelCount() const {return reports.size();}
+  std::size_t threadCount() const {return queues.size();}
+
+  // Note: threads == 0 means one per hardware thread. Shards are dealt out to
+  // the workers round robin, smaller shards balance better but cost more
+  // claims per round.
+  ShardedAnomalyRuntime(std::size_t channels, unsigned int threads = 0,
+                        std::size_t shardSize = 64,
+                        unsigned int windowSize = defaults::window_size,
+                        unsigned int alarmPercentage = defaults::alarm_percentage)
+    : reports(channels) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (shardSize == 0) shardSize = 1;
+
+    for (std::size_t first = 0; first < channels; first += shardSize) {
+      std::size_t count = channels - first < shardSize
+        ? channels - first
+        : shardSize;
+      shards.push_back(Shard{first, std::vector<RingAnomalyDetector>(
+        count, RingAnomalyDetector(windowSize, alarmPercentage))});
+    }
+
+    for (unsigned int t = 0; t < threads; t++) {
+      queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (std::size_t s = 0; s < shards.size(); s++) {
+      queues[s % threads]->shards.push_back((std::uint32_t)s);
+    }
+    for (unsigned int t = 1; t < threads; t++) {
+      workers.emplace_back([this, t] {workerLoop(t);});
+    }
+  }
+
+  ~ShardedAnomalyRuntime() {
+    {
+      std::lock_guard<std::mutex> lock(roundMutex);
+      stopping = true;
+    }
+    roundStart.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+
+  ShardedAnomalyRuntime(const ShardedAnomalyRuntime&) = delete;
+  ShardedAnomalyRuntime& operator=(const ShardedAnomalyRuntime&) = delete;
+};
+
+#endif
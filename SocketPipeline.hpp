@@ -0,0 +1,325 @@
+// NOTE: README.md contains summary docs
+
+#ifndef SOCKET_PIPELINE_HPP
+#define SOCKET_PIPELINE_HPP
+
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "AnomalyDetector.hpp"
+
+// Many socket fed streams on one thread. Each stream is a coroutine that
+// reads raw samples (native int32, as in raw replay files) from its socket
+// into a buffer and hands every read straight to its detector's scanBatch.
+// When the socket has nothing left the coroutine suspends, and the event
+// loop (epoll, edge triggered) resumes it once more data has arrived, so a
+// thread serves thousands of streams with no thread or blocking call per
+// stream.
+// To intern: a coroutine keeps its place in the stream (the partial sample
+// a read ended on, its detector) in its own frame, which is what makes the
+// per-stream code read like a plain blocking loop.
+// Note: a stream reads at most burst_reads buffers in a row before it lets
+// the others have a go, so a busy socket cannot starve the rest. The
+// pipeline owns the descriptors it is given and closes each at end of
+// stream. Linux only (epoll).
+class SocketPipeline {
+public:
+  using Stream = std::uint32_t;
+  using OnEpisode = std::function<void(Stream, const AlarmEpisode&)>;
+
+  struct StreamStats {
+    std::uint64_t samples = 0;
+    std::uint64_t reads = 0;      // reads that returned data
+    std::uint64_t waits = 0;      // times the stream waited for data
+    std::uint64_t episodes = 0;
+    int error = 0;                // errno of a failed read, 0 if none
+    bool finished = false;        // end of stream (or error) reached
+  };
+
+private:
+  static const unsigned int burst_reads = 16;
+
+  struct Task {
+    struct promise_type {
+      std::exception_ptr error;
+
+      Task get_return_object() {
+        return Task{
+          std::coroutine_handle<promise_type>::from_promise(*this)};
+      }
+      std::suspend_always initial_suspend() noexcept {return {};}
+      std::suspend_always final_suspend() noexcept {return {};}
+      void return_void() {}
+      void unhandled_exception() {error = std::current_exception();}
+    };
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  struct Channel {
+    int descriptor;
+    std::coroutine_handle<Task::promise_type> task;
+    bool waiting = false;
+    RingAnomalyDetector detector;
+    std::vector<int> buffer;
+    StreamStats stats;
+  };
+
+  // Result of a read: bytes read, 0 at end of stream, -1 with errno set.
+  // Suspends only when the socket has nothing to read.
+  struct Read {
+    SocketPipeline& pipeline;
+    Stream stream;
+    char* bytes;
+    std::size_t size;
+    ssize_t result = -1;
+    int error = 0;
+
+    bool attempt() {
+      do {
+        result = ::read(pipeline.channels[stream].descriptor, bytes, size);
+      } while (result < 0 && errno == EINTR);
+      error = result < 0 ? errno : 0;
+      return error != EAGAIN && error != EWOULDBLOCK;
+    }
+
+    bool await_ready() {return attempt();}
+
+    void await_suspend(std::coroutine_handle<>) {
+      Channel& channel = pipeline.channels[stream];
+      channel.waiting = true;
+      channel.stats.waits++;
+    }
+
+    ssize_t await_resume() {
+      if (error == EAGAIN || error == EWOULDBLOCK) attempt();
+      errno = error;
+      return result;
+    }
+  };
+
+  // Steps aside until the other streams ready now have run.
+  struct Yield {
+    SocketPipeline& pipeline;
+    Stream stream;
+
+    bool await_ready() {return false;}
+    void await_suspend(std::coroutine_handle<>) {
+      pipeline.ready.push_back(stream);
+    }
+    void await_resume() {}
+  };
+
+  int epollDescriptor;
+  OnEpisode onEpisode;
+  std::size_t bufferSamples;
+  unsigned int windowSize;
+  unsigned int alarmPercentage;
+  // Note: a deque, so adding streams never moves a channel. The coroutines
+  // keep a reference to theirs across co_await, and streams can be added
+  // between the runs of a run() that stopped on an exception.
+  std::deque<Channel> channels;
+  std::vector<Stream> ready;
+  std::vector<Stream> resuming;
+  std::vector<epoll_event> events;
+  std::size_t active = 0;
+  bool running = false;
+
+  Task serve(Stream stream) {
+    std::size_t carried = 0;   // bytes of a partial sample
+    unsigned int burst = 0;
+    while (true) {
+      Channel& channel = channels[stream];
+      char* bytes = reinterpret_cast<char*>(channel.buffer.data());
+      ssize_t count = co_await Read{*this, stream, bytes + carried,
+                                    bufferSamples * sizeof(int) - carried};
+
+      if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          burst = 0;
+          continue;
+        }
+        channel.stats.error = errno;
+        break;
+      }
+      if (count == 0) break;
+
+      std::size_t total = carried + count;
+      std::size_t samples = total / sizeof(int);
+      channel.stats.reads++;
+      channel.stats.samples += samples;
+      channel.detector.scanBatch(
+        std::span<const int>(channel.buffer.data(), samples),
+        [&](const AlarmEpisode& episode) {report(stream, episode);});
+      carried = total % sizeof(int);
+      if (carried > 0) {
+        std::memmove(bytes, bytes + samples * sizeof(int), carried);
+      }
+
+      if (++burst == burst_reads) {
+        burst = 0;
+        co_await Yield{*this, stream};
+      }
+    }
+
+    AlarmEpisode open;
+    if (channels[stream].detector.getOpenEpisode(open)) report(stream, open);
+  }
+
+  void report(Stream stream, const AlarmEpisode& episode) {
+    channels[stream].stats.episodes++;
+    if (onEpisode) onEpisode(stream, episode);
+  }
+
+  void finish(Stream stream) {
+    Channel& channel = channels[stream];
+    std::exception_ptr error = channel.task.promise().error;
+    channel.task.destroy();
+    channel.task = nullptr;
+    close(channel.descriptor);
+    channel.descriptor = -1;
+    channel.stats.finished = true;
+    active--;
+    if (error) std::rethrow_exception(error);
+  }
+
+  void resume(Stream stream) {
+    Channel& channel = channels[stream];
+    channel.task.resume();
+    if (channel.task.done()) finish(stream);
+  }
+
+public:
+  // Takes over descriptor (a connected stream socket or a pipe), which is
+  // switched to non-blocking. Not while run() is running. The descriptor is
+  // owned by the pipeline even when this throws, in which case it has been
+  // closed.
+  Stream addStream(int descriptor) {
+    auto fail = [descriptor](const std::string& what) {
+      std::string message = what + std::strerror(errno);
+      close(descriptor);
+      throw std::runtime_error(message);
+    };
+    if (running) {
+      close(descriptor);
+      throw std::runtime_error("cannot add a stream while running");
+    }
+    int flags = fcntl(descriptor, F_GETFL);
+    if (flags < 0 || fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) < 0) {
+      fail("cannot set O_NONBLOCK: ");
+    }
+    Stream stream = (Stream)channels.size();
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.u32 = stream;
+    if (epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, descriptor, &event) < 0) {
+      fail("cannot watch stream: ");
+    }
+
+    channels.push_back(Channel{descriptor, nullptr, false,
+                               RingAnomalyDetector(windowSize,
+                                                   alarmPercentage),
+                               std::vector<int>(bufferSamples), {}});
+    channels.back().task = serve(stream).handle;
+    ready.push_back(stream);
+    active++;
+    return stream;
+  }
+
+  // Serves every stream until each has reached its end. Rethrows an
+  // exception thrown by onEpisode (the stream it came from is finished, the
+  // others carry on with the next run()).
+  void run() {
+    running = true;
+    ready.reserve(channels.size());
+    resuming.reserve(channels.size());
+    std::size_t resumed = 0;
+    try {
+      while (active > 0) {
+        int timeout = ready.empty() ? -1 : 0;
+        int count = epoll_wait(epollDescriptor, events.data(),
+                               (int)events.size(), timeout);
+        if (count < 0 && errno != EINTR) {
+          throw std::runtime_error(std::string("epoll_wait failed: ") +
+                                   std::strerror(errno));
+        }
+        for (int i = 0; i < count; i++) {
+          Channel& channel = channels[events[i].data.u32];
+          if (channel.waiting) {
+            channel.waiting = false;
+            ready.push_back(events[i].data.u32);
+          }
+        }
+
+        // Note: streams that yield now go to the back of the next round
+        resuming.swap(ready);
+        while (resumed < resuming.size()) resume(resuming[resumed++]);
+        resuming.clear();
+        resumed = 0;
+      }
+    } catch (...) {
+      ready.insert(ready.begin(), resuming.begin() + resumed,
+                   resuming.end());
+      resuming.clear();
+      running = false;
+      throw;
+    }
+    running = false;
+  }
+
+  // getters
+  const StreamStats& getStats(Stream stream) const {
+    return channels[stream].stats;
+  }
+  const RingAnomalyDetector& getDetector(Stream stream) const {
+    return channels[stream].detector;
+  }
+  std::size_t streamCount() const {return channels.size();}
+  std::size_t activeStreams() const {return active;}
+
+  // bufferSamples: size of each stream's read buffer, in samples
+  explicit SocketPipeline(
+      OnEpisode onEpisode = {}, std::size_t bufferSamples = 4096,
+      unsigned int windowSize = defaults::window_size,
+      unsigned int alarmPercentage = defaults::alarm_percentage)
+    : epollDescriptor(epoll_create1(EPOLL_CLOEXEC)),
+      onEpisode(std::move(onEpisode)),
+      bufferSamples(bufferSamples < 1 ? 1 : bufferSamples),
+      windowSize(windowSize),
+      alarmPercentage(alarmPercentage),
+      events(256) {
+    if (epollDescriptor < 0) {
+      throw std::runtime_error(std::string("cannot create epoll instance: ")
+                               + std::strerror(errno));
+    }
+  }
+
+  ~SocketPipeline() {
+    for (Channel& channel : channels) {
+      if (channel.task) channel.task.destroy();
+      if (channel.descriptor >= 0) close(channel.descriptor);
+    }
+    close(epollDescriptor);
+  }
+
+  // Coroutine frames refer to the pipeline, so it stays where it was built.
+  SocketPipeline(const SocketPipeline&) = delete;
+  SocketPipeline& operator=(const SocketPipeline&) = delete;
+};
+
+#endif
@@ -0,0 +1,106 @@
+// NOTE: README.md contains summary docs
+
+#ifndef SPSC_RING_BUFFER_HPP
+#define SPSC_RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <span>
+
+// Wait-free single-producer/single-consumer ring buffer for handing samples
+// from a receive thread to a detection thread in bulk.
+//
+// The producer asks for room with acquireWrite(), fills what it got and
+// publishes it with commitWrite(); the consumer mirrors that with
+// acquireRead()/release(). Each call is a bounded number of steps with no
+// locks or CAS loops. The spans returned are contiguous, so near the end of
+// the buffer they can be shorter than asked for; call again after committing
+// or releasing to get the part that wrapped around.
+// Note: head and tail live on separate cache lines and each side keeps a
+// cached copy of the other side's index, so the shared lines are only read
+// when the cached copy cannot satisfy the request.
+template <typename T>
+class SpscRingBuffer {
+private:
+  static const std::size_t cache_line = 64;
+
+  // consumer side
+  alignas(cache_line) std::atomic<std::size_t> head{0};
+  std::size_t cachedTail = 0;
+
+  // producer side
+  alignas(cache_line) std::atomic<std::size_t> tail{0};
+  std::size_t cachedHead = 0;
+
+  alignas(cache_line) std::size_t mask;
+  std::unique_ptr<T[]> slots;
+
+public:
+  // Producer: up to maxCount writable slots (possibly none when full).
+  std::span<T> acquireWrite(std::size_t maxCount) {
+    std::size_t writeIndex = tail.load(std::memory_order_relaxed);
+    std::size_t capacity = mask + 1;
+    if (capacity - (writeIndex - cachedHead) < maxCount) {
+      cachedHead = head.load(std::memory_order_acquire);
+    }
+    std::size_t free = capacity - (writeIndex - cachedHead);
+    std::size_t offset = writeIndex & mask;
+    std::size_t contiguous = capacity - offset;
+
+    std::size_t count = free < contiguous ? free : contiguous;
+    if (maxCount < count) count = maxCount;
+    return std::span<T>(slots.get() + offset, count);
+  }
+
+  // Producer: publishes the first count slots of the last acquireWrite().
+  void commitWrite(std::size_t count) {
+    tail.store(tail.load(std::memory_order_relaxed) + count,
+               std::memory_order_release);
+  }
+
+  // Consumer: up to maxCount readable samples (possibly none when empty).
+  std::span<const T> acquireRead(std::size_t maxCount) {
+    std::size_t readIndex = head.load(std::memory_order_relaxed);
+    if (cachedTail - readIndex < maxCount) {
+      cachedTail = tail.load(std::memory_order_acquire);
+    }
+    std::size_t available = cachedTail - readIndex;
+    std::size_t offset = readIndex & mask;
+    std::size_t contiguous = mask + 1 - offset;
+
+    std::size_t count = available < contiguous ? available : contiguous;
+    if (maxCount < count) count = maxCount;
+    return std::span<const T>(slots.get() + offset, count);
+  }
+
+  // Consumer: frees the first count samples of the last acquireRead().
+  void release(std::size_t count) {
+    head.store(head.load(std::memory_order_relaxed) + count,
+               std::memory_order_release);
+  }
+
+  // Either side: number of samples waiting. Only a snapshot since the other
+  // side keeps moving, which is all backpressure reporting needs.
+  std::size_t size() const {
+    std::size_t readIndex = head.load(std::memory_order_acquire);
+    std::size_t writeIndex = tail.load(std::memory_order_acquire);
+    return writeIndex - readIndex;
+  }
+
+  std::size_t capacity() const {return mask + 1;}
+
+  // To intern: the capacity is rounded up to a power of two so wrapping is a
+  // mask instead of a division.
+  SpscRingBuffer(std::size_t minCapacity) {
+    std::size_t capacity = 1;
+    while (capacity < minCapacity) capacity *= 2;
+    mask = capacity - 1;
+    slots = std::make_unique<T[]>(capacity);
+  }
+
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+};
+
+#endif
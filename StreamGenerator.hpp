@@ -0,0 +1,371 @@
+// NOTE: README.md contains summary docs
+
+#ifndef STREAM_GENERATOR_HPP
+#define STREAM_GENERATOR_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Synthetic sample streams for tests and load generation.
+//
+// Randomness comes from Philox4x32-10, a counter-based generator: the random
+// words for sample i are a pure function of (seed, i), so any segment of a
+// stream can be produced on its own, by any thread, in any order, and is
+// bit-for-bit identical to the same segment of a sequential run.
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3"). One call turns a 128 bit counter into four 32 bit random words.
+namespace philox
+{
+    // The ten rounds on a whole counter and key, given as words in the
+    // order of the published known-answer vectors.
+    inline std::array<std::uint32_t, 4> rounds(
+        std::array<std::uint32_t, 4> counter,
+        std::array<std::uint32_t, 2> key) {
+      const std::uint32_t multiplier0 = 0xD2511F53;
+      const std::uint32_t multiplier1 = 0xCD9E8D57;
+      const std::uint32_t weyl0 = 0x9E3779B9;
+      const std::uint32_t weyl1 = 0xBB67AE85;
+
+      auto [c0, c1, c2, c3] = counter;
+      auto [k0, k1] = key;
+
+      for (int round = 0; round < 10; round++) {
+        std::uint64_t product0 = (std::uint64_t)multiplier0 * c0;
+        std::uint64_t product1 = (std::uint64_t)multiplier1 * c2;
+        std::uint32_t next0 = (std::uint32_t)(product1 >> 32) ^ c1 ^ k0;
+        std::uint32_t next2 = (std::uint32_t)(product0 >> 32) ^ c3 ^ k1;
+        c1 = (std::uint32_t)product1;
+        c3 = (std::uint32_t)product0;
+        c0 = next0;
+        c2 = next2;
+        k0 += weyl0;
+        k1 += weyl1;
+      }
+      return {c0, c1, c2, c3};
+    }
+
+    // Counter words 0-1 are the counter, word 2 the stream and word 3 is 0.
+    inline std::array<std::uint32_t, 4> generate(std::uint64_t counter,
+                                                 std::uint32_t stream,
+                                                 std::uint64_t key) {
+      return rounds({(std::uint32_t)counter, (std::uint32_t)(counter >> 32),
+                     stream, 0},
+                    {(std::uint32_t)key, (std::uint32_t)(key >> 32)});
+    }
+
+#if defined(__AVX2__)
+    // High and low halves of the 32x32 bit products of every lane of x with
+    // multiplier (AVX2 only multiplies the even lanes, so do it twice).
+    inline void multiplyHighLow(__m256i x, __m256i multiplier, __m256i& high,
+                                __m256i& low) {
+      __m256i even = _mm256_mul_epu32(x, multiplier);
+      __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), multiplier);
+      low = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+      high = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xaa);
+    }
+#endif
+
+    // Writes the words of counters firstCounter .. firstCounter + counters - 1
+    // to out (4 per counter, in order). Same output as calling generate() in
+    // a loop; with AVX2 eight counters go through the rounds together.
+    inline void fill(std::uint64_t firstCounter, std::size_t counters,
+                     std::uint32_t stream, std::uint64_t key,
+                     std::uint32_t* out) {
+      std::size_t c = 0;
+#if defined(__AVX2__)
+      for (; c + 8 <= counters; c += 8) {
+        std::uint64_t base = firstCounter + c;
+        __m256i low = _mm256_set1_epi32((int)(std::uint32_t)base);
+        __m256i c0 = _mm256_add_epi32(
+          low, _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        // lanes whose low word wrapped carry into the high word (the
+        // signed compare is made unsigned by flipping the sign bits)
+        const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+        __m256i wrapped = _mm256_cmpgt_epi32(_mm256_xor_si256(low, sign),
+                                             _mm256_xor_si256(c0, sign));
+        __m256i c1 = _mm256_sub_epi32(
+          _mm256_set1_epi32((int)(std::uint32_t)(base >> 32)), wrapped);
+        __m256i c2 = _mm256_set1_epi32((int)stream);
+        __m256i c3 = _mm256_setzero_si256();
+        __m256i k0 = _mm256_set1_epi32((int)(std::uint32_t)key);
+        __m256i k1 = _mm256_set1_epi32((int)(std::uint32_t)(key >> 32));
+        const __m256i multiplier0 = _mm256_set1_epi32((int)0xD2511F53);
+        const __m256i multiplier1 = _mm256_set1_epi32((int)0xCD9E8D57);
+        const __m256i weyl0 = _mm256_set1_epi32((int)0x9E3779B9);
+        const __m256i weyl1 = _mm256_set1_epi32((int)0xBB67AE85);
+
+        for (int round = 0; round < 10; round++) {
+          __m256i high0, low0, high1, low1;
+          multiplyHighLow(c0, multiplier0, high0, low0);
+          multiplyHighLow(c2, multiplier1, high1, low1);
+          c0 = _mm256_xor_si256(_mm256_xor_si256(high1, c1), k0);
+          c2 = _mm256_xor_si256(_mm256_xor_si256(high0, c3), k1);
+          c1 = low1;
+          c3 = low0;
+          k0 = _mm256_add_epi32(k0, weyl0);
+          k1 = _mm256_add_epi32(k1, weyl1);
+        }
+
+        // 4x8 transpose so each counter's four words end up adjacent
+        __m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+        __m256i t1 = _mm256_unpackhi_epi32(c0, c1);
+        __m256i t2 = _mm256_unpacklo_epi32(c2, c3);
+        __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2); // counters 0 and 4
+        __m256i u1 = _mm256_unpackhi_epi64(t0, t2); // counters 1 and 5
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3); // counters 2 and 6
+        __m256i u3 = _mm256_unpackhi_epi64(t1, t3); // counters 3 and 7
+        __m256i* target = (__m256i*)(out + c * 4);
+        _mm256_storeu_si256(target, _mm256_permute2x128_si256(u0, u1, 0x20));
+        _mm256_storeu_si256(target + 1,
+                            _mm256_permute2x128_si256(u2, u3, 0x20));
+        _mm256_storeu_si256(target + 2,
+                            _mm256_permute2x128_si256(u0, u1, 0x31));
+        _mm256_storeu_si256(target + 3,
+                            _mm256_permute2x128_si256(u2, u3, 0x31));
+      }
+#endif
+      for (; c < counters; c++) {
+        auto words = generate(firstCounter + c, stream, key);
+        for (int word = 0; word < 4; word++) out[c * 4 + word] = words[word];
+      }
+    }
+}
+
+// How sample values are drawn in one regime. Samples are independent and
+// uniform over `levels` distinct values centred on 0 (so negative values are
+// exercised too); levels == 0 means the full int range. Fewer levels mean
+// more ties and therefore fewer strict peaks:
+//   P(peak) = (levels - 1)(2 levels - 1) / (6 levels^2)
+// which tends to 1/3 for the full range (the healthy ~33%), is about 0.185
+// for 3 levels and 0.125 for 2.
+struct Regime {
+  unsigned int levels;
+
+  static Regime healthy() {return Regime{0};}
+  static Regime degraded() {return Regime{3};}
+
+  double expectedPeakRate() const {
+    if (levels == 0) return 1.0 / 3.0;
+    double k = levels;
+    return (k - 1) * (2 * k - 1) / (6 * k * k);
+  }
+
+  int sample(std::uint32_t random) const {
+    if (levels == 0) return (int)random;
+    return (int)(((std::uint64_t)random * levels) >> 32) - (int)(levels / 2);
+  }
+};
+
+// A stream that is either a single regime or switches between two regimes
+// as a Markov chain (per sample probabilities of leaving each regime).
+// Note: to keep segments reproducible from seed + offset the chain restarts
+// every epoch_size samples from a regime drawn from its stationary
+// distribution, so seeking replays at most one epoch of switch decisions.
+// Sequential users should go through StreamCursor, which carries the chain
+// state and never replays.
+class StreamGenerator {
+public:
+  static const std::uint64_t epoch_size = 1 << 16;
+
+private:
+  static const std::uint32_t value_stream = 0;
+  static const std::uint32_t switch_stream = 1;
+  static const std::uint32_t epoch_stream = 2;
+  static const std::size_t chunk_size = 256;
+
+  std::uint64_t seed;
+  std::array<Regime, 2> regimes;
+  std::array<std::uint32_t, 2> leaveThreshold; // P(leave) scaled to 2^32
+  std::uint32_t startThreshold; // P(start an epoch in regime 0) scaled
+  bool switching;
+
+  static std::uint32_t scaled(double probability) {
+    if (probability <= 0) return 0;
+    if (probability >= 1) return UINT32_MAX;
+    return (std::uint32_t)(probability * 4294967296.0);
+  }
+
+  std::uint32_t switchWord(std::uint64_t index) const {
+    return philox::generate(index / 4, switch_stream, seed)[index % 4];
+  }
+
+  unsigned int epochStartRegime(std::uint64_t epoch) const {
+    return philox::generate(epoch, epoch_stream, seed)[0] < startThreshold
+      ? 0
+      : 1;
+  }
+
+  unsigned int step(std::uint64_t index, unsigned int regime) const {
+    if (index % epoch_size == 0) return epochStartRegime(index / epoch_size);
+    return regime ^ (switchWord(index) < leaveThreshold[regime]);
+  }
+
+public:
+  // Regime of the chain right before sample `offset`, replaying from the
+  // start of its epoch (step() redraws the regime on the epoch's first
+  // sample, so the starting value of the replay does not matter).
+  unsigned int regimeBefore(std::uint64_t offset) const {
+    if (!switching) return 0;
+    std::uint64_t epochStart = offset - offset % epoch_size;
+    unsigned int regime = 0;
+    for (std::uint64_t i = epochStart; i < offset; i++) {
+      regime = step(i, regime);
+    }
+    return regime;
+  }
+
+  // Fills out with samples offset, offset + 1, ... and returns the regime the
+  // chain is in after the last one. regime is the chain state before
+  // `offset` (ignored for single regime streams).
+  // To intern: random words are made a chunk at a time with philox::fill
+  // (vectorised where possible) and then turned into samples; a chunk that
+  // does not start on a multiple of 4 just skips the first words.
+  unsigned int fillFrom(std::uint64_t offset, unsigned int regime,
+                        std::span<int> out) const {
+    std::uint32_t valueWords[chunk_size + 4];
+    std::uint32_t switchWords[chunk_size + 4];
+
+    for (std::size_t position = 0; position < out.size();) {
+      std::uint64_t index = offset + position;
+      std::size_t skip = index % 4;
+      std::size_t count = out.size() - position < chunk_size
+        ? out.size() - position
+        : chunk_size;
+      std::size_t counters = (skip + count + 3) / 4;
+      int* samples = out.data() + position;
+
+      philox::fill(index / 4, counters, value_stream, seed, valueWords);
+      if (!switching) {
+        const Regime only = regimes[0];
+        for (std::size_t k = 0; k < count; k++) {
+          samples[k] = only.sample(valueWords[skip + k]);
+        }
+      } else {
+        philox::fill(index / 4, counters, switch_stream, seed, switchWords);
+        for (std::size_t k = 0; k < count; k++) {
+          if ((index + k) % epoch_size == 0) {
+            regime = epochStartRegime((index + k) / epoch_size);
+          } else {
+            regime ^= switchWords[skip + k] < leaveThreshold[regime];
+          }
+          samples[k] = regimes[regime].sample(valueWords[skip + k]);
+        }
+      }
+      position += count;
+    }
+    return regime;
+  }
+
+  // Fills out with samples offset, offset + 1, ...
+  void fill(std::uint64_t offset, std::span<int> out) const {
+    fillFrom(offset, regimeBefore(offset), out);
+  }
+
+  // Same as fill but split over threads (0 = one per hardware thread).
+  // The result does not depend on the number of threads.
+  void fillParallel(std::uint64_t offset, std::span<int> out,
+                    unsigned int threads = 0) const {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 1 || out.size() < threads * epoch_size) {
+      fill(offset, out);
+      return;
+    }
+
+    std::size_t share = out.size() / threads;
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads; t++) {
+      std::size_t begin = t * share;
+      std::size_t end = t + 1 == threads ? out.size() : begin + share;
+      workers.emplace_back([=, this] {
+        fill(offset + begin, out.subspan(begin, end - begin));
+      });
+    }
+    for (auto& worker : workers) worker.join();
+  }
+
+  double expectedPeakRate() const {
+    if (!switching) return regimes[0].expectedPeakRate();
+    double toOne = leaveThreshold[0] / 4294967296.0;
+    double toZero = leaveThreshold[1] / 4294967296.0;
+    if (toOne + toZero == 0) return regimes[0].expectedPeakRate();
+    double inZero = toZero / (toOne + toZero);
+    return inZero * regimes[0].expectedPeakRate() +
+           (1 - inZero) * regimes[1].expectedPeakRate();
+  }
+
+  bool isSwitching() const {return switching;}
+
+  // Single regime stream.
+  explicit StreamGenerator(std::uint64_t seed,
+                           Regime regime = Regime::healthy())
+    : seed(seed), regimes{regime, regime}, leaveThreshold{0, 0},
+      startThreshold(UINT32_MAX), switching(false) {}
+
+  // Markov switching between two regimes. leaveFirst/leaveSecond are the
+  // per-sample probabilities of switching away from each regime.
+  StreamGenerator(std::uint64_t seed, Regime first, Regime second,
+                  double leaveFirst, double leaveSecond)
+    : seed(seed), regimes{first, second},
+      leaveThreshold{scaled(leaveFirst), scaled(leaveSecond)},
+      startThreshold(scaled(leaveFirst + leaveSecond > 0
+        ? leaveSecond / (leaveFirst + leaveSecond)
+        : 1.0)),
+      switching(true) {}
+};
+
+// Sequential reader over a StreamGenerator that refills a small buffer in
+// bulk, for callers that want one sample at a time.
+class StreamCursor {
+private:
+  static const std::size_t buffer_size = 1024;
+
+  StreamGenerator generator;
+  std::uint64_t offset;
+  unsigned int regime;
+  std::array<int, buffer_size> buffer;
+  std::size_t position = buffer_size;
+
+  void generate(std::span<int> out) {
+    regime = generator.fillFrom(offset, regime, out);
+    offset += out.size();
+  }
+
+public:
+  int next() {
+    if (position == buffer_size) {
+      generate(buffer);
+      position = 0;
+    }
+    return buffer[position++];
+  }
+
+  // Bulk form of next(). Samples next() already buffered come out first, so
+  // the two can be mixed freely; the rest is generated straight into out.
+  void fill(std::span<int> out) {
+    std::size_t pending = std::min(out.size(), buffer_size - position);
+    std::copy_n(buffer.begin() + position, pending, out.begin());
+    position += pending;
+    if (pending < out.size()) generate(out.subspan(pending));
+  }
+
+  // Offset of the sample the next call to next() or fill() returns.
+  std::uint64_t getOffset() const {return offset - (buffer_size - position);}
+
+  explicit StreamCursor(const StreamGenerator& generator,
+                        std::uint64_t offset = 0)
+    : generator(generator), offset(offset),
+      regime(generator.regimeBefore(offset)) {}
+};
+
+#endif
@@ -0,0 +1,336 @@
+// NOTE: README.md contains summary docs
+
+#ifndef TEXT_INPUT_HPP
+#define TEXT_INPUT_HPP
+
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__SSE4_1__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <unistd.h>
+
+// Delimited integer text (one sample per line, comma separated, or any mix
+// of ',', ' ', '\t', '\r' and '\n') parsed straight into int blocks for the
+// detector's batch path. Negative numbers are supported, as the stream was
+// never specified to be nonnegative.
+//
+// A token is a maximal run of non-delimiter characters. Valid tokens are an
+// optional '-' followed by 1 to 10 digits that fit in an int; anything else
+// (e.g. "12x", "-", "+3", "99999999999") is skipped and counted as rejected,
+// like std::from_chars reporting an error.
+namespace text_input
+{
+    // Bytes that must be readable after the end of the text handed to
+    // parse() (their contents do not matter).
+    static const std::size_t padding = 64;
+
+    enum CharClass : unsigned char {digit, minus, delimiter, other};
+
+    inline constexpr std::array<unsigned char, 256> char_classes = [] {
+      std::array<unsigned char, 256> classes{};
+      for (int c = 0; c < 256; c++) classes[c] = other;
+      for (int c = '0'; c <= '9'; c++) classes[c] = digit;
+      classes['-'] = minus;
+      for (unsigned char c : {',', ' ', '\t', '\r', '\n'}) {
+        classes[c] = delimiter;
+      }
+      return classes;
+    }();
+
+    inline bool isDelimiter(char c) {
+      return char_classes[(unsigned char)c] == delimiter;
+    }
+
+    // Slow path for one token starting at text (not a delimiter) and ending
+    // before end: validates it character by character. Returns the first
+    // byte after the token.
+    inline const char* parseToken(const char* text, const char* end,
+                                  int* out, std::size_t& count,
+                                  std::uint64_t& rejected) {
+      const char* cursor = text;
+      bool negative = *cursor == '-';
+      cursor += negative;
+      std::uint64_t value = 0;
+      unsigned int digits = 0;
+      while (cursor < end && char_classes[(unsigned char)*cursor] == digit) {
+        value = value * 10 + (*cursor - '0');
+        cursor++;
+        // 11 digits no longer fit, stop before value could wrap
+        if (++digits > 10) break;
+      }
+
+      std::uint64_t limit = negative ? std::uint64_t(INT_MAX) + 1 : INT_MAX;
+      bool valid = digits > 0 && digits <= 10 && value <= limit &&
+                   (cursor == end || isDelimiter(*cursor));
+      while (cursor < end && !isDelimiter(*cursor)) cursor++;
+
+      if (valid) {
+        out[count++] = (int)(negative ? 0 - value : value);
+      } else {
+        rejected++;
+      }
+      return cursor;
+    }
+
+#if defined(__SSE4_1__)
+    // shuffle masks moving the first length bytes to the top of a 16 byte
+    // register and zeroing the rest (0x80 selects zero)
+    inline constexpr std::array<std::array<char, 16>, 17> align_digits = [] {
+      std::array<std::array<char, 16>, 17> masks{};
+      for (int length = 0; length <= 16; length++) {
+        for (int i = 0; i < 16; i++) {
+          int from = i - (16 - length);
+          masks[length][i] = from >= 0 ? (char)from : (char)0x80;
+        }
+      }
+      return masks;
+    }();
+#endif
+
+    // Finds the run of digits at text (up to 16 bytes are read) and returns
+    // its length; when it is 1 to 16 digits long, value is set to it.
+    // SSE4.1: classify 16 bytes with one compare, then right-align the
+    // digits with a shuffle and combine pairs, quads and octets with
+    // multiply-adds. Otherwise 8 bytes at a time in a 64 bit register (SWAR,
+    // "SIMD within a register"), which covers up to 7 digits and leaves
+    // longer tokens to the slow path.
+    inline unsigned int scanDigits(const char* text, std::uint64_t& value) {
+#if defined(__SSE4_1__)
+      __m128i chunk = _mm_loadu_si128((const __m128i*)text);
+      __m128i digitValues = _mm_sub_epi8(chunk, _mm_set1_epi8('0'));
+      __m128i isDigit = _mm_cmpeq_epi8(
+        _mm_min_epu8(digitValues, _mm_set1_epi8(9)), digitValues);
+      unsigned int stops = ~(unsigned)_mm_movemask_epi8(isDigit) & 0xFFFF;
+      unsigned int length = std::countr_zero(stops | 0x10000);
+
+      __m128i aligned = _mm_shuffle_epi8(
+        digitValues,
+        _mm_loadu_si128((const __m128i*)align_digits[length].data()));
+      __m128i pairs = _mm_maddubs_epi16(
+        aligned, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1,
+                               10, 1, 10, 1, 10, 1, 10, 1));
+      __m128i quads = _mm_madd_epi16(
+        pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+      quads = _mm_packus_epi32(quads, quads);
+      __m128i octets = _mm_madd_epi16(
+        quads, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+      value = std::uint64_t((std::uint32_t)_mm_cvtsi128_si32(octets)) *
+                100000000 +
+              (std::uint32_t)_mm_extract_epi32(octets, 1);
+      return length;
+#else
+      static_assert(std::endian::native == std::endian::little,
+                    "the SWAR digit parser assumes a little-endian host");
+      const std::uint64_t ones = 0x0101010101010101;
+      std::uint64_t word;
+      std::memcpy(&word, text, sizeof(word));
+      // bytes that are not '0'..'9' become non-zero. Adding 6 can carry
+      // into the next byte, but only out of a byte that is already not a
+      // digit, so the first non-digit is still found correctly.
+      std::uint64_t nonDigits =
+        ((word & (0xF0 * ones)) ^ (0x30 * ones)) |
+        (((word + 0x06 * ones) & (0xF0 * ones)) ^ (0x30 * ones));
+      std::uint64_t stops =
+        (((nonDigits & (0x7F * ones)) + (0x7F * ones)) | nonDigits) &
+        (0x80 * ones);
+      if (!stops) return 16;  // 8 or more digits, take the slow path
+      unsigned int length = std::countr_zero(stops) / 8;
+      if (length == 0) return 0;
+
+      // digit values, shifted so the last digit is the top byte; the bytes
+      // shifted in at the bottom are leading zeros
+      value = (word - 0x30 * ones) << (8 * (8 - length));
+      value = ((value & (0x0F * ones)) * 2561) >> 8;
+      value = ((value & 0x00FF00FF00FF00FF) * 6553601) >> 16;
+      value = ((value & 0x0000FFFF0000FFFF) * 42949672960001) >> 32;
+      return length;
+#endif
+    }
+
+    // Bit i set when text[i] is a delimiter, for 64 bytes.
+    inline std::uint64_t delimiterMask(const char* text) {
+#if defined(__AVX2__)
+      auto half = [](const char* bytes) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)bytes);
+        auto is = [&](char c) {
+          return _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c));
+        };
+        __m256i delimiters = _mm256_or_si256(
+          _mm256_or_si256(is(','), is(' ')),
+          _mm256_or_si256(is('\n'), _mm256_or_si256(is('\r'), is('\t'))));
+        return (std::uint64_t)(std::uint32_t)_mm256_movemask_epi8(delimiters);
+      };
+      return half(text) | (half(text + 32) << 32);
+#else
+      std::uint64_t mask = 0;
+      for (unsigned int i = 0; i < 64; i++) {
+        mask |= std::uint64_t(isDelimiter(text[i])) << i;
+      }
+      return mask;
+#endif
+    }
+
+    // Parses complete tokens from [begin, end) into out (at most
+    // out.size()), sets begin to where it stopped and returns how many
+    // integers were written. begin must be at the start of a token or at a
+    // delimiter. A token is only complete once it is followed by a
+    // delimiter or by end, so pass only text up to a delimiter unless the
+    // input is finished. At least `padding` bytes after end must be
+    // readable.
+    // To intern: this works in two steps, like simdjson. The delimiters of
+    // 64 bytes are found at once as a bitmask, and the tokens start where a
+    // delimiter is followed by anything else, so where the next token starts
+    // never depends on parsing the current one and consecutive tokens are
+    // parsed in parallel by the CPU. Each token is then converted without
+    // looking at its characters one by one (scanDigits); the rare cases
+    // (long or malformed tokens) drop to parseToken.
+    inline std::size_t parse(const char*& begin, const char* end,
+                             std::span<int> out, std::uint64_t& rejected) {
+      std::size_t count = 0;
+      std::uint64_t previousIsDelimiter = 1;
+
+      for (const char* block = begin; block < end; block += 64) {
+        std::uint64_t delimiters = delimiterMask(block);
+        std::uint64_t starts =
+          ~delimiters & ((delimiters << 1) | previousIsDelimiter);
+        if (end - block < 64) starts &= (std::uint64_t(1) << (end - block)) - 1;
+        previousIsDelimiter = delimiters >> 63;
+
+        for (; starts; starts &= starts - 1) {
+          const char* token = block + std::countr_zero(starts);
+          if (count == out.size()) {
+            begin = token;
+            return count;
+          }
+
+          bool negative = *token == '-';
+          const char* digits = token + negative;
+          std::uint64_t value = 0;
+          unsigned int length = scanDigits(digits, value);
+          const char* after = digits + length;
+          std::uint64_t limit =
+            negative ? std::uint64_t(INT_MAX) + 1 : INT_MAX;
+
+          if (length == 0 || length > 10 || value > limit ||
+              (after < end ? !isDelimiter(*after) : after > end)) {
+            parseToken(token, end, out.data(), count, rejected);
+          } else {
+            out[count++] = (int)(negative ? 0 - value : value);
+          }
+        }
+      }
+
+      begin = end;
+      return count;
+    }
+
+    // Reads delimited integers from a file descriptor (stdin, a pipe, a
+    // socket or a file) in large blocks, with no per-line allocation. A
+    // token split across two reads is carried over to the next block.
+    class IntegerReader {
+    private:
+      int descriptor;
+      std::vector<char> buffer;
+      std::size_t blockBytes;
+      std::size_t begin = 0;     // next byte to parse
+      std::size_t complete = 0;  // end of the complete tokens
+      std::size_t filled = 0;    // end of the bytes read
+      bool finished = false;
+      bool skipping = false;     // dropping an overlong token
+      std::uint64_t rejected = 0;
+      std::uint64_t bytes = 0;
+
+      // Refills the buffer and moves complete past the last delimiter.
+      // Returns false at the end of the input.
+      bool refill() {
+        std::memmove(buffer.data(), buffer.data() + begin, filled - begin);
+        filled -= begin;
+        begin = complete = 0;
+
+        while (!finished) {
+          if (filled == blockBytes) {
+            // a single token fills the whole buffer, drop it
+            rejected += !skipping;
+            skipping = true;
+            filled = 0;
+          }
+          ssize_t result = ::read(descriptor, buffer.data() + filled,
+                                  blockBytes - filled);
+          if (result < 0 && errno == EINTR) continue;
+          if (result < 0) {
+            throw std::runtime_error(std::string("cannot read input: ") +
+                                     std::strerror(errno));
+          }
+          bytes += result;
+          std::size_t start = filled;
+          filled += result;
+          if (result == 0) {
+            finished = true;
+            break;
+          }
+          if (skipping) {
+            while (start < filled && !isDelimiter(buffer[start])) start++;
+            if (start == filled) {
+              filled = 0;
+              continue;
+            }
+            skipping = false;
+            std::memmove(buffer.data(), buffer.data() + start,
+                         filled - start);
+            filled -= start;
+            start = 0;
+          }
+
+          std::size_t last = filled;
+          while (last > start && !isDelimiter(buffer[last - 1])) last--;
+          if (last > start) {
+            complete = last;
+            return true;
+          }
+        }
+
+        // end of input: whatever is left is the last token
+        complete = skipping ? 0 : filled;
+        if (skipping) filled = 0;
+        return complete > 0;
+      }
+
+    public:
+      // Fills out with up to out.size() integers and returns how many were
+      // read (0 at the end of the input).
+      std::size_t read(std::span<int> out) {
+        std::size_t count = 0;
+        while (count < out.size()) {
+          if (begin == complete && !refill()) break;
+          const char* cursor = buffer.data() + begin;
+          count += parse(cursor, buffer.data() + complete,
+                         out.subspan(count), rejected);
+          begin = cursor - buffer.data();
+        }
+        return count;
+      }
+
+      std::uint64_t getRejected() const {return rejected;}
+      std::uint64_t getBytesRead() const {return bytes;}
+
+      explicit IntegerReader(int descriptor,
+                             std::size_t blockBytes = std::size_t(1) << 20)
+        : descriptor(descriptor),
+          buffer(blockBytes + padding),
+          blockBytes(blockBytes) {}
+    };
+}
+
+#endif
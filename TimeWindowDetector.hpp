@@ -0,0 +1,197 @@
+// NOTE: README.md contains summary docs
+
+#ifndef TIME_WINDOW_DETECTOR_HPP
+#define TIME_WINDOW_DETECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "AnomalyDetector.hpp"
+#include "PeakKernel.hpp"
+
+namespace defaults
+{
+    static const std::uint64_t time_window_ns = 100'000'000'000ull; // 100s
+    static const std::uint64_t time_bucket_ns = 1'000'000ull;       // 1ms
+}
+
+// Sliding window over the last windowNs nanoseconds instead of the last N
+// samples, for feeds with irregular sample rates. The alarm fires when fewer
+// than alarmPercentage percent of the samples that fell in the window
+// confirmed a peak.
+//
+// Time is cut into buckets of bucketNs and the window is a ring of
+// windowNs / bucketNs buckets, each counting its samples and peaks, plus
+// running totals over the ring. A sample costs O(1) however bursty the data
+// is, and memory is fixed by the ring size. Moving time forward only visits
+// the buckets that held samples, so a long quiet spell costs no more than a
+// busy one (amortised over the samples that filled those buckets).
+// Note: the window edge is only as precise as a bucket. Peaks are counted in
+// the bucket of the sample that confirms them, like AnomalyDetector records
+// the sample number of the confirming sample. Timestamps must not go
+// backwards; a sample older than the newest bucket is counted in the newest
+// bucket.
+class TimeWindowAnomalyDetector {
+private:
+  struct Bucket {
+    std::uint64_t index = 0; // which bucket of time this slot holds
+    std::uint32_t samples = 0;
+    std::uint32_t peaks = 0;
+  };
+
+  int prevPoint = 0;
+  bool prevIsPossiblePeak = false;
+  bool alarmActive = false;
+  std::uint64_t datumNum = 0;
+
+  std::uint64_t bucketNs;
+  std::uint64_t bucketCount;
+  unsigned int alarmPercentage;
+  std::vector<Bucket> buckets;
+  std::uint64_t currentBucket = 0;
+  std::uint64_t firstTimestamp = 0;
+  std::uint64_t samplesInWindow = 0;
+  std::uint64_t peaksInWindow = 0;
+
+  // The numbers of the buckets that hold samples, oldest first, in a ring of
+  // bucketCount entries (no more buckets than that are ever in the window).
+  std::vector<std::uint64_t> occupied;
+  std::size_t occupiedFirst = 0;
+  std::size_t occupiedCount = 0;
+
+  // To intern: the running totals only include buckets in
+  // (currentBucket - bucketCount, currentBucket]. Expiring walks the
+  // occupied buckets rather than every bucket of elapsed time, so a sample
+  // after a long quiet spell does not step through up to bucketCount empty
+  // buckets. Each bucket is queued by the sample that opens it and expired
+  // once, which makes the update amortised O(1) per sample; a gap of a whole
+  // window or more drops everything at once.
+  void advanceTo(std::uint64_t bucket) {
+    if (bucket <= currentBucket) return;
+
+    if (bucket - currentBucket >= bucketCount) {
+      samplesInWindow = 0;
+      peaksInWindow = 0;
+      occupiedCount = 0;
+    }
+    while (occupiedCount > 0 &&
+           occupied[occupiedFirst] + bucketCount <= bucket) {
+      const Bucket& slot = buckets[occupied[occupiedFirst] % bucketCount];
+      samplesInWindow -= slot.samples;
+      peaksInWindow -= slot.peaks;
+      occupiedFirst = occupiedFirst + 1 == bucketCount ? 0 : occupiedFirst + 1;
+      occupiedCount--;
+    }
+    currentBucket = bucket;
+  }
+
+  // Slides the window to timestamp and counts one sample in it.
+  void addSample(std::uint64_t timestamp, bool isPeak) {
+    if (datumNum == 0) {
+      firstTimestamp = timestamp;
+      currentBucket = timestamp / bucketNs;
+    }
+    datumNum++;
+    advanceTo(timestamp / bucketNs);
+
+    // a slot still holding an older bucket only holds expired samples
+    Bucket& slot = buckets[currentBucket % bucketCount];
+    if (slot.index != currentBucket || slot.samples == 0) {
+      slot = Bucket{currentBucket, 0, 0};
+      std::size_t last = occupiedFirst + occupiedCount;
+      occupied[last < bucketCount ? last : last - bucketCount] = currentBucket;
+      occupiedCount++;
+    }
+    slot.samples++;
+    slot.peaks += isPeak;
+    samplesInWindow++;
+    peaksInWindow += isPeak;
+
+    checkForAnomaly(timestamp);
+  }
+
+  // To intern: peaks < ceil(samples * percentage / 100) is the same as
+  // peaks * 100 < samples * percentage for integers, without the division.
+  void checkForAnomaly(std::uint64_t timestamp) {
+    bool minTimeElapsed =
+      timestamp >= firstTimestamp + bucketNs * bucketCount;
+    bool peaksBelowThreshold =
+      peaksInWindow * 100 < samplesInWindow * alarmPercentage;
+
+    alarmActive = minTimeElapsed && peaksBelowThreshold;
+  }
+
+public:
+  void processNewDataPoint(int dataPoint, std::uint64_t timestampNs) {
+    addSample(timestampNs, dataPoint < prevPoint && prevIsPossiblePeak);
+
+    prevIsPossiblePeak = dataPoint > prevPoint && datumNum > 1;
+    prevPoint = dataPoint;
+  }
+
+  // Batch version of processNewDataPoint (timestampsNs[i] belongs to
+  // data[i]). Same contract as AnomalyDetector::processBatch: stops after the
+  // first sample that leaves the alarm active and returns its index, or
+  // data.size() if there was none. Throws std::invalid_argument, before
+  // consuming anything, unless there is one timestamp per sample.
+  std::size_t processBatch(std::span<const int> data,
+                           std::span<const std::uint64_t> timestampsNs) {
+    if (timestampsNs.size() != data.size()) {
+      throw std::invalid_argument("batch does not hold one timestamp per "
+                                  "sample");
+    }
+    std::uint64_t peakBits[peak_kernel::block_words];
+    peak_kernel::Carry carry{prevPoint, prevIsPossiblePeak, datumNum > 0};
+
+    for (std::size_t base = 0; base < data.size();
+         base += peak_kernel::block_size) {
+      const int* block = data.data() + base;
+      std::size_t count = data.size() - base < peak_kernel::block_size
+        ? data.size() - base
+        : peak_kernel::block_size;
+      peak_kernel::findPeaks(block, count, carry, peakBits);
+
+      for (std::size_t i = 0; i < count; i++) {
+        addSample(timestampsNs[base + i], (peakBits[i / 64] >> (i % 64)) & 1);
+        if (alarmActive) {
+          carry = peak_kernel::carryAfter(block, i, carry);
+          prevPoint = carry.prevPoint;
+          prevIsPossiblePeak = carry.prevIsPossiblePeak;
+          return base + i;
+        }
+      }
+      carry = peak_kernel::carryAfter(block, count - 1, carry);
+    }
+
+    prevPoint = carry.prevPoint;
+    prevIsPossiblePeak = carry.prevIsPossiblePeak;
+    return data.size();
+  }
+
+  // getters
+  bool getAlarmActive() const {return alarmActive;}
+  std::uint64_t getDatumNum() const {return datumNum;}
+  std::uint64_t getSamplesInWindow() const {return samplesInWindow;}
+  std::uint64_t getPeaksInWindow() const {return peaksInWindow;}
+
+  // Note: windowNs is rounded up to a whole number of buckets. Throws
+  // std::invalid_argument for a bucket size of 0.
+  TimeWindowAnomalyDetector(
+      std::uint64_t windowNs = defaults::time_window_ns,
+      unsigned int alarmPercentage = defaults::alarm_percentage,
+      std::uint64_t bucketNs = defaults::time_bucket_ns)
+    : bucketNs(bucketNs), bucketCount(1), alarmPercentage(alarmPercentage) {
+    if (bucketNs == 0) {
+      throw std::invalid_argument("bucket size must be at least 1 ns");
+    }
+    bucketCount = (windowNs + bucketNs - 1) / bucketNs;
+    if (bucketCount == 0) bucketCount = 1;
+    buckets.resize(bucketCount);
+    occupied.resize(bucketCount);
+  }
+};
+
+#endif
@@ -0,0 +1,726 @@
+// NOTE: README.md contains summary docs
+
+// Microbenchmarks for AnomalyDetector, built as AnomalyDetector_bench.
+// Usage: AnomalyDetector_bench [name filter]
+//
+// To intern: every input stream is generated before the clock starts, so the
+// numbers are detector cost only (the old approach of wrapping the random
+// loop in a big for loop mostly measured std::rand). Each case runs until it
+// has taken at least min_seconds, is repeated a few times and the median
+// repetition is reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <span>
+#include <string>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "AnomalyDetector.hpp"
+#include "DetectorFleet.hpp"
+#include "FusedDetector.hpp"
+#include "MultiWindowDetector.hpp"
+#include "ReorderBuffer.hpp"
+#include "SocketPipeline.hpp"
+#include "StreamGenerator.hpp"
+#include "TextInput.hpp"
+
+namespace bench
+{
+    static const double min_seconds = 0.1;
+    static const int repetitions = 5;
+    static const std::size_t stream_size = 1 << 22;
+
+    std::string filter;
+    volatile std::uint64_t sink;
+
+    void print(const std::string& name, double nsPerSample) {
+      std::cout << std::left << std::setw(48) << name << std::right
+                << std::fixed << std::setprecision(3) << std::setw(10)
+                << nsPerSample << " ns/sample" << std::setw(10)
+                << std::setprecision(1) << 1e3 / nsPerSample
+                << " M samples/s" << std::endl;
+    }
+
+    // Runs body (which must consume `samples` samples) until min_seconds
+    // have passed, repetitions times, and prints the median cost per sample.
+    // Returns the median in ns per sample (0 if filtered out).
+    double run(const std::string& name, std::size_t samples,
+               const std::function<std::uint64_t()>& body) {
+      if (name.find(filter) == std::string::npos) return 0;
+
+      std::vector<double> nsPerSample;
+      for (int r = 0; r < repetitions; r++) {
+        std::uint64_t iterations = 0;
+        std::chrono::duration<double> elapsed{0};
+        auto start = std::chrono::steady_clock::now();
+        do {
+          sink = sink + body();
+          iterations++;
+          elapsed = std::chrono::steady_clock::now() - start;
+        } while (elapsed.count() < min_seconds);
+        nsPerSample.push_back(elapsed.count() * 1e9 / (iterations * samples));
+      }
+      std::sort(nsPerSample.begin(), nsPerSample.end());
+      double median = nsPerSample[nsPerSample.size() / 2];
+      print(name, median);
+      return median;
+    }
+
+    // Input streams. "random" matches getFromRandom() (the healthy regime).
+    std::vector<int> randomStream(std::size_t size, unsigned int seed) {
+      std::vector<int> stream(size);
+      StreamGenerator(seed).fill(0, stream);
+      return stream;
+    }
+
+    std::vector<int> allPeaksStream(std::size_t size) {
+      std::vector<int> stream(size);
+      for (std::size_t i = 0; i < size; i++) stream[i] = i % 2;
+      return stream;
+    }
+
+    std::vector<int> noPeaksStream(std::size_t size) {
+      return std::vector<int>(size, 3);
+    }
+
+    std::vector<int> monotonicStream(std::size_t size) {
+      std::vector<int> stream(size);
+      for (std::size_t i = 0; i < size; i++) stream[i] = (int)i;
+      return stream;
+    }
+
+    // The fakeStreamList pattern from main.cpp (13 peaks, then a flat run of
+    // 3s) repeated.
+    std::vector<int> fakeListStream(std::size_t size) {
+      std::vector<int> pattern;
+      for (int i = 0; i < 26; i++) pattern.push_back(1 - i % 2);
+      for (int i = 0; i < 52; i++) pattern.push_back(3);
+      std::vector<int> stream(size);
+      for (std::size_t i = 0; i < size; i++) {
+        stream[i] = pattern[i % pattern.size()];
+      }
+      return stream;
+    }
+
+    // stream as text, one delimiter after every sample
+    std::string textStream(const std::vector<int>& stream,
+                           const std::string& delimiter) {
+      std::string text;
+      for (int value : stream) text += std::to_string(value) + delimiter;
+      return text;
+    }
+
+    template <typename Detector, typename... Args>
+    void perSample(const std::string& name, const std::vector<int>& stream,
+                   Args... args) {
+      Detector detector(args...);
+      run(name, stream.size(), [&] {
+        std::uint64_t alarms = 0;
+        for (int value : stream) {
+          detector.processNewDataPoint(value);
+          alarms += detector.getAlarmActive();
+        }
+        return alarms;
+      });
+    }
+
+    template <typename Detector, typename Sample = int, typename... Args>
+    void batch(const std::string& name, const std::vector<Sample>& stream,
+               Args... args) {
+      Detector detector(args...);
+      run(name, stream.size(), [&] {
+        std::uint64_t episodes = 0;
+        detector.scanBatch(stream, [&](const AlarmEpisode&) {episodes++;});
+        return episodes;
+      });
+    }
+
+    // Resident set size in bytes, 0 where /proc/self/statm is missing.
+    std::size_t residentBytes() {
+      std::ifstream statm("/proc/self/statm");
+      std::size_t pages = 0;
+      std::size_t resident = 0;
+      statm >> pages >> resident;
+      return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    // The layout DetectorFleet replaces: a vector of detectors, each owning
+    // its window storage, with the same free list so only the storage
+    // differs. create() assigns a fresh detector, freeing the old storage.
+    template <typename Detector>
+    class VectorFleet {
+    private:
+      unsigned int windowSize;
+      std::vector<Detector> detectors;
+      std::vector<std::uint32_t> freeChannels;
+
+    public:
+      std::uint32_t create() {
+        std::uint32_t channel = freeChannels.back();
+        freeChannels.pop_back();
+        detectors[channel] = Detector(windowSize, 25u);
+        return channel;
+      }
+      void destroy(std::uint32_t channel) {freeChannels.push_back(channel);}
+      Detector& operator[](std::uint32_t channel) {return detectors[channel];}
+
+      VectorFleet(std::size_t capacity, unsigned int windowSize, unsigned int)
+        : windowSize(windowSize) {
+        detectors.reserve(capacity);
+        for (std::size_t i = 0; i < capacity; i++) {
+          detectors.emplace_back(windowSize, 25u);
+          freeChannels.push_back((std::uint32_t)(capacity - 1 - i));
+        }
+      }
+    };
+
+    // channels detectors of one layout, every one fed a full window first.
+    // Prints the resident set growth from building and filling the fleet,
+    // then times feeding every channel chunk samples (process) and
+    // replacing a channel and feeding it chunk samples (churn).
+    template <typename Fleet>
+    void fleet(const std::string& name, std::size_t channels,
+               unsigned int window, const std::vector<int>& stream) {
+      const std::string cases[] = {name + "/rss", name + "/process",
+                                   name + "/churn"};
+      if (std::none_of(std::begin(cases), std::end(cases),
+                       [](const std::string& c) {
+                         return c.find(filter) != std::string::npos;
+                       })) {
+        return;
+      }
+
+      const std::size_t chunk = 64;
+      std::span<const int> data(stream);
+      std::size_t round = 0;
+      auto feed = [&](auto& detector, std::size_t channel,
+                      std::size_t count) {
+        std::size_t offset =
+          (channel * 7919 + round * chunk) % (data.size() - count);
+        std::uint64_t episodes = 0;
+        detector.scanBatch(data.subspan(offset, count),
+                           [&](const AlarmEpisode&) {episodes++;});
+        return episodes;
+      };
+
+#if defined(__GLIBC__)
+      malloc_trim(0);
+#endif
+      std::size_t before = residentBytes();
+      Fleet detectors(channels, window, 25u);
+      for (std::size_t c = 0; c < channels; c++) {
+        std::uint32_t channel = detectors.create();
+        sink = sink + feed(detectors[channel], channel, window + chunk);
+      }
+      std::size_t grown = residentBytes() - before;
+      if (cases[0].find(filter) != std::string::npos) {
+        std::cout << std::left << std::setw(48) << cases[0] << std::right
+                  << std::setw(10) << std::fixed << std::setprecision(1)
+                  << grown / 1e6
+                  << " MB" << std::setw(10) << grown / channels
+                  << " bytes/channel" << std::endl;
+      }
+
+      run(cases[1], channels * chunk, [&] {
+        std::uint64_t episodes = 0;
+        for (std::size_t c = 0; c < channels; c++) {
+          episodes += feed(detectors[c], c, chunk);
+        }
+        round++;
+        return episodes;
+      });
+
+      const std::size_t replaced = 1024;
+      run(cases[2], replaced * chunk, [&] {
+        std::uint64_t episodes = 0;
+        for (std::size_t i = 0; i < replaced; i++) {
+          std::uint32_t channel =
+            (std::uint32_t)((i * 7919 + round) % channels);
+          detectors.destroy(channel);
+          channel = detectors.create();
+          episodes += feed(detectors[channel], channel, chunk);
+        }
+        round++;
+        return episodes;
+      });
+    }
+
+    // processBatch over the whole stream, resuming after every alarm stop.
+    template <typename Detector, typename... Args>
+    void stops(const std::string& name, const std::vector<int>& stream,
+               Args... args) {
+      Detector detector(args...);
+      std::span<const int> data(stream);
+      run(name, stream.size(), [&] {
+        std::uint64_t stopped = 0;
+        for (std::size_t position = 0; position < data.size();) {
+          position += detector.processBatch(data.subspan(position)) + 1;
+          stopped++;
+        }
+        return stopped;
+      });
+    }
+
+    // Times every processNewDataPoint call on its own. Uses the time stamp
+    // counter where there is one (reported in cycles), otherwise the steady
+    // clock (reported in ns). The cost of reading the timer is measured and
+    // subtracted, so treat the low percentiles as approximate.
+    template <typename Detector>
+    void latency(const std::string& name, const std::vector<int>& stream) {
+      if (name.find(filter) == std::string::npos) return;
+
+#if defined(__x86_64__) || defined(__i386__)
+      auto now = [] {return (std::int64_t)__rdtsc();};
+      const char* unit = "cycles";
+#else
+      auto now = [] {
+        return (std::int64_t)std::chrono::duration_cast<
+          std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+      };
+      const char* unit = "ns";
+#endif
+      std::vector<std::int64_t> overhead(1 << 16);
+      for (auto& sample : overhead) {
+        std::int64_t start = now();
+        sample = now() - start;
+      }
+      std::sort(overhead.begin(), overhead.end());
+      std::int64_t timerCost = overhead[overhead.size() / 2];
+
+      Detector detector;
+      std::vector<std::int64_t> costs(stream.size());
+      for (std::size_t i = 0; i < stream.size(); i++) {
+        std::int64_t start = now();
+        detector.processNewDataPoint(stream[i]);
+        costs[i] = std::max<std::int64_t>(now() - start - timerCost, 0);
+      }
+      sink = sink + detector.getAlarmActive();
+      std::sort(costs.begin(), costs.end());
+
+      auto percentile = [&](double p) {
+        return costs[std::min(costs.size() - 1,
+                              (std::size_t)(p / 100 * costs.size()))];
+      };
+      std::cout << std::left << std::setw(48) << name << std::right
+                << " p50 " << percentile(50) << " p90 " << percentile(90)
+                << " p99 " << percentile(99) << " p99.9 " << percentile(99.9)
+                << " max " << costs.back() << " " << unit << std::endl;
+    }
+
+    // SocketPipeline serving `streams` local socket pairs on this thread.
+    // Each socket is filled with samplesPerStream samples and closed before
+    // the clock starts, so only the pipeline is timed (reads, coroutine
+    // switches, epoll and detection), not a feeder. Repeated like run().
+    void sockets(const std::string& name, std::size_t streams,
+                 std::size_t samplesPerStream,
+                 const std::vector<int>& stream) {
+      if (name.find(filter) == std::string::npos) return;
+      rlimit limit;
+      if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+          limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+      }
+
+      std::vector<double> nsPerSample;
+      for (int r = 0; r < repetitions; r++) {
+        std::uint64_t episodes = 0;
+        SocketPipeline pipeline(
+          [&](SocketPipeline::Stream, const AlarmEpisode&) {episodes++;});
+        for (std::size_t s = 0; s < streams; s++) {
+          int pair[2];
+          if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+            std::cout << name << ": socketpair failed" << std::endl;
+            return;
+          }
+          std::size_t offset = (s * 7919) % (stream.size() - samplesPerStream);
+          const char* bytes =
+            reinterpret_cast<const char*>(stream.data() + offset);
+          std::size_t size = samplesPerStream * sizeof(int);
+          for (std::size_t done = 0; done < size;) {
+            ssize_t sent = write(pair[1], bytes + done, size - done);
+            if (sent <= 0) {
+              std::cout << name << ": socket write failed" << std::endl;
+              return;
+            }
+            done += sent;
+          }
+          close(pair[1]);
+          pipeline.addStream(pair[0]);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        pipeline.run();
+        std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+        nsPerSample.push_back(elapsed.count() * 1e9 /
+                              (streams * samplesPerStream));
+        sink = sink + episodes;
+      }
+      std::sort(nsPerSample.begin(), nsPerSample.end());
+      print(name, nsPerSample[nsPerSample.size() / 2]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bench::filter = argc > 1 ? argv[1] : "";
+    // Note: AnomalyDetector_bench_instrumented is this file built with
+    // ANOMALY_DETECTOR_INSTRUMENT; comparing it with AnomalyDetector_bench
+    // shows the cost of the probes, and AnomalyDetector_bench against a
+    // build from before they existed shows the disabled build is unchanged.
+    std::cout << "instrumentation: "
+              << (instrumentation::enabled ? "enabled" : "disabled")
+              << std::endl;
+
+    const std::vector<int> random = bench::randomStream(bench::stream_size, 1);
+    const std::vector<std::pair<std::string, std::vector<int>>> shapes = {
+      {"random", random},
+      {"all_peaks", bench::allPeaksStream(bench::stream_size)},
+      {"no_peaks", bench::noPeaksStream(bench::stream_size)},
+      {"monotonic", bench::monotonicStream(bench::stream_size)},
+      {"fake_stream_list", bench::fakeListStream(bench::stream_size)},
+    };
+
+    // throughput of the default configuration (100 samples, 25%)
+    for (const auto& [shape, stream] : shapes) {
+      bench::perSample<AnomalyDetector>("per_sample/deque/" + shape, stream);
+      bench::perSample<RingAnomalyDetector>("per_sample/ring/" + shape,
+                                            stream);
+      bench::perSample<StaticAnomalyDetector<>>("per_sample/static/" + shape,
+                                                stream);
+      bench::batch<AnomalyDetector>("batch/deque/" + shape, stream);
+      bench::batch<RingAnomalyDetector>("batch/ring/" + shape, stream);
+      bench::batch<StaticAnomalyDetector<>>("batch/static/" + shape, stream);
+    }
+
+    // slack skipping against the exact per-sample path. That both give the
+    // same alarms is checked by AnomalyDetector_tests, this only times them.
+    for (const auto& [shape, stream] : shapes) {
+      for (unsigned int window : {100u, 10000u}) {
+        std::string name = shape + "/" + std::to_string(window);
+        bench::batch<RingAnomalyDetector>("slack/on/" + name, stream, window,
+                                          25u);
+        RingAnomalyDetector detector(window, 25u);
+        detector.setSlackSkipping(false);
+        bench::run("slack/off/" + name, stream.size(), [&] {
+          std::uint64_t episodes = 0;
+          detector.scanBatch(stream, [&](const AlarmEpisode&) {episodes++;});
+          return episodes;
+        });
+      }
+    }
+
+    // fused single loop against the staged detector. That both give the
+    // same alarms is checked by AnomalyDetector_tests, this only times them.
+    for (const auto& [shape, stream] : shapes) {
+      bench::stops<RingAnomalyDetector>("fused/off/" + shape, stream);
+      bench::stops<FusedAnomalyDetector>("fused/on/" + shape, stream);
+    }
+
+    // sample types: the random stream as int32, int64 and float
+    {
+      std::vector<std::int64_t> wide(random.begin(), random.end());
+      std::vector<float> real(random.begin(), random.end());
+      bench::batch<TypedAnomalyDetector<std::int32_t>>("sample/int32/random",
+                                                       random);
+      bench::batch<TypedAnomalyDetector<std::int64_t>>("sample/int64/random",
+                                                       wide);
+      bench::batch<TypedAnomalyDetector<float>>("sample/float/random", real);
+    }
+
+    // window sizes, 25%
+    for (unsigned int window : {8u, 64u, 100u, 1000u, 10000u, 100000u,
+                                1000000u}) {
+      std::string size = std::to_string(window);
+      bench::perSample<AnomalyDetector>("window/deque/" + size, random,
+                                        window, 25u);
+      bench::batch<RingAnomalyDetector>("window/ring/" + size, random,
+                                        window, 25u);
+    }
+
+    // alarm percentages, window of 100
+    for (unsigned int percentage : {10u, 25u, 33u, 50u, 90u}) {
+      std::string name = std::to_string(percentage);
+      bench::batch<RingAnomalyDetector>("percentage/ring/" + name, random,
+                                        100u, percentage);
+    }
+
+    // peak definitions, window of 100, 25%
+    for (const auto& [shape, stream] : shapes) {
+      bench::batch<PolicyAnomalyDetector<StrictPeakPolicy>>(
+        "policy/strict/" + shape, stream);
+      bench::batch<PolicyAnomalyDetector<PlateauPeakPolicy>>(
+        "policy/plateau/" + shape, stream);
+      bench::batch<PolicyAnomalyDetector<ProminencePeakPolicy<2>>>(
+        "policy/prominence:2/" + shape, stream);
+    }
+
+    // peak history: what recording costs the batch path (against the same
+    // detector without one) and random range queries over the recording
+    {
+      bench::batch<RingAnomalyDetector>("history/off/random", random);
+      RingAnomalyDetector detector;
+      PeakHistory history;
+      detector.attachHistory(&history);
+      detector.scanBatch(random, [](const AlarmEpisode&) {});
+      bench::run("history/on/random", random.size(), [&] {
+        std::uint64_t episodes = 0;
+        detector.scanBatch(random, [&](const AlarmEpisode&) {episodes++;});
+        history.discardBefore(detector.getSamplesConsumed() - random.size());
+        return episodes;
+      });
+
+      std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges(1 << 16);
+      StreamGenerator bounds(2);
+      std::vector<int> ends(2 * ranges.size());
+      bounds.fill(0, ends);
+      std::uint64_t held = history.getEnd() - history.getFirst();
+      for (std::size_t i = 0; i < ranges.size(); i++) {
+        std::uint64_t a = history.getFirst() + (unsigned int)ends[2 * i] % held;
+        std::uint64_t b =
+          history.getFirst() + (unsigned int)ends[2 * i + 1] % held;
+        ranges[i] = {std::min(a, b), std::max(a, b)};
+      }
+      bench::run("history/query", ranges.size(), [&] {
+        std::uint64_t peaks = 0;
+        for (const auto& [begin, end] : ranges) {
+          peaks += history.peakCount(begin, end);
+        }
+        return peaks;
+      });
+    }
+
+    // peak trace: scanBatch writing the peak count of every sample, of every
+    // 100th (most slack skipping survives) and not at all
+    {
+      std::vector<std::uint16_t> counts(random.size());
+      std::vector<float> percentages(random.size());
+      auto traced = [&](const std::string& name, auto& values,
+                        unsigned int every) {
+        RingAnomalyDetector detector;
+        bench::run(name, random.size(), [&] {
+          PeakTrace trace{std::span(values), every};
+          std::uint64_t episodes = 0;
+          detector.scanBatch(random, [&](const AlarmEpisode&) {episodes++;},
+                             trace);
+          return episodes + trace.written;
+        });
+      };
+      RingAnomalyDetector detector;
+      bench::run("trace/off/random", random.size(), [&] {
+        std::uint64_t episodes = 0;
+        detector.scanBatch(random, [&](const AlarmEpisode&) {episodes++;});
+        return episodes;
+      });
+      traced("trace/count:1/random", counts, 1);
+      traced("trace/count:100/random", counts, 100);
+      traced("trace/percent:1/random", percentages, 1);
+    }
+
+    // sequenced ingestion: reorder buffer plus detector against the detector
+    // alone, with datagrams of 16 samples arriving in order, out of order (up
+    // to 4 datagrams late) and out of order with 1% of them lost
+    {
+      const std::size_t datagram = 16;
+      StreamGenerator jitter(3);
+      std::vector<int> draws(random.size() / datagram);
+      jitter.fill(0, draws);
+      std::vector<std::uint64_t> inOrder;
+      for (std::size_t i = 0; i < random.size(); i += datagram) {
+        inOrder.push_back(i);
+      }
+      std::vector<std::uint64_t> shuffled = inOrder;
+      for (std::size_t p = 0; p + 5 <= shuffled.size(); p += 5) {
+        std::size_t late = (unsigned int)draws[p] % 5;
+        std::rotate(shuffled.begin() + p, shuffled.begin() + p + late,
+                    shuffled.begin() + p + 5);
+      }
+      std::vector<std::uint64_t> lossy;
+      for (std::size_t i = 0; i < shuffled.size(); i++) {
+        if ((unsigned int)draws[i] / 5 % 100 != 0) lossy.push_back(shuffled[i]);
+      }
+
+      bench::batch<RingAnomalyDetector>("reorder/none/random", random);
+      // Note: no lossy/wait, waiting on a lost datagram stalls the stream
+      // until a flush, which a real feed would do on a timer.
+      const std::vector<std::pair<std::string, GapPolicy>> policies = {
+        {"wait", GapPolicy::wait},
+        {"skip", GapPolicy::skip},
+        {"interpolate", GapPolicy::interpolate}};
+      const std::vector<std::pair<std::string, std::vector<std::uint64_t>*>>
+        feeds = {{"in_order", &inOrder}, {"shuffled", &shuffled},
+                 {"lossy", &lossy}};
+      for (const auto& [feed, arrivals] : feeds) {
+        for (const auto& [policy, gapPolicy] : policies) {
+          if (feed == "lossy" && gapPolicy == GapPolicy::wait) continue;
+          RingAnomalyDetector detector;
+          ReorderBuffer<int> reorder(256, gapPolicy);
+          std::uint64_t first = 0;
+          std::string name = "reorder/" + feed + "/" + policy;
+          bench::run(name, arrivals->size() * datagram, [&] {
+            std::uint64_t episodes = 0;
+            auto onRun = [&](std::span<const int> run) {
+              detector.scanBatch(run, [&](const AlarmEpisode&) {episodes++;});
+            };
+            for (std::uint64_t sequence : *arrivals) {
+              reorder.push(first + sequence,
+                           std::span<const int>(random).subspan(sequence,
+                                                                datagram),
+                           onRun);
+            }
+            reorder.release(onRun);
+            first += random.size();
+            return episodes;
+          });
+          const ReorderCounters& counters = reorder.getCounters();
+          if (counters.received > 0 && feed != "in_order") {
+            std::cout << name << " counters: reordered "
+                      << counters.reordered << " dropped "
+                      << counters.dropped() << " skipped "
+                      << counters.skipped << " interpolated "
+                      << counters.interpolated << std::endl;
+          }
+        }
+      }
+    }
+
+    // socket fed streams multiplexed on one thread (SocketPipeline): total
+    // samples per second on one core, whatever the number of streams
+    for (std::size_t streams : {100, 1000, 4000}) {
+      bench::sockets("sockets/" + std::to_string(streams), streams, 8192,
+                     random);
+    }
+
+    // several windows over one stream: shared peak stream vs one detector
+    // per window
+    {
+      const std::vector<WindowConfig> windows = {
+        {100, 25}, {1000, 25}, {100000, 20}};
+      MultiWindowAnomalyDetector shared(windows);
+      bench::run("multi_window/shared/3", random.size(), [&] {
+        std::uint64_t alarms = 0;
+        for (std::size_t position = 0; position < random.size();) {
+          position += shared.processBatch(
+            std::span<const int>(random).subspan(position)) + 1;
+          alarms++;
+        }
+        return alarms;
+      });
+
+      std::vector<RingAnomalyDetector> separate;
+      for (const WindowConfig& window : windows) {
+        separate.emplace_back(window.windowSize, window.alarmPercentage);
+      }
+      bench::run("multi_window/separate/3", random.size(), [&] {
+        std::uint64_t episodes = 0;
+        for (auto& detector : separate) {
+          detector.scanBatch(random, [&](const AlarmEpisode&) {episodes++;});
+        }
+        return episodes;
+      });
+    }
+
+    // 100k channel fleets: one arena (DetectorFleet) against a vector of
+    // detectors owning their windows. The arena runs first, the deques last,
+    // so the heap the deques leave behind does not skew the other numbers.
+    for (unsigned int window : {100u, 1000u}) {
+      std::string size = std::to_string(window);
+      const std::size_t channels = 100000;
+      DetectorFleet footprint(channels, window);
+      if (("fleet/arena/" + size).find(bench::filter) != std::string::npos) {
+        DetectorFleet::Footprint bytes = footprint.footprint();
+        std::cout << "fleet/arena/" << size << " footprint: " << bytes.total()
+                  << " bytes, " << bytes.perChannel() << " per channel ("
+                  << bytes.windowBytes << " windows, " << bytes.detectorBytes
+                  << " detectors, " << bytes.freeListBytes << " free list)"
+                  << std::endl;
+      }
+      bench::fleet<DetectorFleet>("fleet/arena/" + size, channels, window,
+                                  random);
+      bench::fleet<bench::VectorFleet<RingAnomalyDetector>>(
+        "fleet/ring/" + size, channels, window, random);
+      bench::fleet<bench::VectorFleet<AnomalyDetector>>(
+        "fleet/deque/" + size, channels, window, random);
+    }
+
+    // text parsing (stdin mode), without the detector
+    {
+      std::vector<int> wide(bench::stream_size);
+      for (std::size_t i = 0; i < wide.size(); i++) {
+        wide[i] = (int)(i * 2654435761u);
+      }
+      const std::vector<std::pair<std::string, std::string>> texts = {
+        {"newline/random", bench::textStream(random, "\n")},
+        {"comma/random", bench::textStream(random, ", ")},
+        {"newline/wide", bench::textStream(wide, "\n")},
+      };
+      std::vector<int> parsed(bench::stream_size);
+      for (const auto& [format, text] : texts) {
+        std::vector<char> padded(text.size() + text_input::padding);
+        std::copy(text.begin(), text.end(), padded.begin());
+        double ns = bench::run("parse/" + format, parsed.size(), [&] {
+          const char* cursor = padded.data();
+          std::uint64_t rejected = 0;
+          std::size_t count = text_input::parse(
+            cursor, padded.data() + text.size(), parsed, rejected);
+          return (std::uint64_t)count + rejected;
+        });
+        if (ns > 0) {
+          std::cout << std::left << std::setw(48) << ("parse/" + format)
+                    << std::right << std::setw(10) << std::setprecision(2)
+                    << text.size() / (ns * parsed.size()) << " GB/s"
+                    << std::endl;
+        }
+      }
+    }
+
+    // synthetic stream generation (what load tests pay per sample)
+    std::vector<int> generated(bench::stream_size);
+    const std::vector<std::pair<std::string, StreamGenerator>> generators = {
+      {"healthy", StreamGenerator(1)},
+      {"degraded", StreamGenerator(1, Regime::degraded())},
+      {"markov", StreamGenerator(1, Regime::healthy(), Regime::degraded(),
+                                 1e-4, 3e-4)},
+    };
+    for (const auto& [regime, generator] : generators) {
+      bench::run("generator/" + regime, generated.size(), [&] {
+        generator.fill(0, generated);
+        return (std::uint64_t)generated[0];
+      });
+    }
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    bench::run("generator/healthy/threads:" + std::to_string(threads),
+               generated.size(), [&] {
+      generators[0].second.fillParallel(0, generated, threads);
+      return (std::uint64_t)generated[0];
+    });
+
+    std::vector<int> latencyStream(random.begin(), random.begin() + (1 << 20));
+    bench::latency<AnomalyDetector>("latency/deque/random", latencyStream);
+    bench::latency<RingAnomalyDetector>("latency/ring/random", latencyStream);
+    bench::latency<StaticAnomalyDetector<>>("latency/static/random",
+                                            latencyStream);
+
+    if (instrumentation::enabled) {
+      instrumentation::writeText(std::cout, instrumentation::snapshot());
+    }
+    return 0;
+}
@@ -0,0 +1,958 @@
+// NOTE: README.md contains summary docs
+
+// Differential fuzzer for the detectors, built as AnomalyDetector_fuzz.
+// Usage: AnomalyDetector_fuzz [seconds] [seed] [threads] [first case]
+//
+// Every case draws a window configuration and a stream (random, or one of
+// the adversarial shapes in fillShape), works out the alarm state after
+// every sample with a deliberately naive reference and then runs the stream
+// through every detector variant, cut into packets of random size. The first
+// sample on which a variant disagrees with the reference (alarm index, episode
+// or traced peak count) stops the run with the seed and case number, and the
+// stream is written to the current directory as a raw replay file.
+// To intern: the reference shares no code with the detectors. Peaks are
+// found from their definition and the window count is redone from scratch
+// for every sample, O(window), so a bookkeeping bug in any of the optimised
+// paths (slack skipping, SIMD peak finding, fused stretches, bit rings,
+// counter renumbering) shows up as a divergence instead of being repeated by
+// the oracle.
+// Note: seconds 0 with a first case runs just that case, which is how a
+// reported divergence is replayed. Cases are numbered from the seed, so a run
+// is reproducible whatever the number of threads.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AnomalyDetector.hpp"
+#include "AnomalyDetectorBank.hpp"
+#include "Checkpoint.hpp"
+#include "DetectorFleet.hpp"
+#include "FusedDetector.hpp"
+#include "MultiWindowDetector.hpp"
+#include "PeakPolicy.hpp"
+#include "ReorderBuffer.hpp"
+#include "StreamGenerator.hpp"
+
+namespace fuzz
+{
+    // naive reference work per case (samples x window) is kept below this
+    static const std::uint64_t reference_budget = 1 << 25;
+    static const std::size_t max_stream_size = 1 << 17;
+    static const unsigned int bank_channels = 9;
+    static const int prominence_delta = 2;
+
+    struct Config {
+      unsigned int windowSize;
+      unsigned int alarmPercentage;
+    };
+
+    // The alarm state after every sample, from the definition: the alarm is
+    // on after sample i once the window has filled and fewer than
+    // alarmPercentage percent of its samples (i - windowSize, i] confirmed a
+    // peak.
+    struct Reference {
+      std::vector<std::uint32_t> counts;
+      std::vector<std::uint8_t> alarms;
+      std::vector<std::size_t> nextAlarm; // first alarm at or after i, or n
+      std::vector<AlarmEpisode> episodes; // the last one may still be open
+    };
+
+    Reference reference(const std::vector<std::uint8_t>& peaks,
+                        Config config) {
+      std::size_t n = peaks.size();
+      std::uint64_t window = config.windowSize;
+      Reference result;
+      result.counts.resize(n);
+      result.alarms.resize(n);
+      result.nextAlarm.resize(n + 1);
+
+      for (std::size_t i = 0; i < n; i++) {
+        std::size_t first = i + 1 >= window ? i + 1 - window : 0;
+        std::uint32_t count = 0;
+        for (std::size_t j = first; j <= i; j++) count += peaks[j];
+        result.counts[i] = count;
+        result.alarms[i] = i + 1 >= window &&
+          std::uint64_t(count) * 100 < window * config.alarmPercentage;
+      }
+
+      result.nextAlarm[n] = n;
+      for (std::size_t i = n; i-- > 0;) {
+        result.nextAlarm[i] = result.alarms[i] ? i : result.nextAlarm[i + 1];
+      }
+      for (std::size_t i = 0; i < n; i++) {
+        if (!result.alarms[i]) continue;
+        if (i == 0 || !result.alarms[i - 1]) {
+          result.episodes.push_back(AlarmEpisode{i, n, result.counts[i]});
+        }
+        AlarmEpisode& episode = result.episodes.back();
+        if (result.counts[i] < episode.minPeakCount) {
+          episode.minPeakCount = result.counts[i];
+        }
+        if (i + 1 < n && !result.alarms[i + 1]) episode.end = i + 1;
+      }
+      return result;
+    }
+
+    // Sample i confirms a strict peak when sample i - 1 is higher than both
+    // of its neighbours.
+    template <typename Sample>
+    std::vector<std::uint8_t> strictPeaks(const std::vector<Sample>& data) {
+      std::vector<std::uint8_t> peaks(data.size(), 0);
+      for (std::size_t i = 2; i < data.size(); i++) {
+        peaks[i] = data[i - 1] > data[i - 2] && data[i - 1] > data[i];
+      }
+      return peaks;
+    }
+
+    // A flat top counts once: sample i confirms a peak when it is lower than
+    // sample i - 1 and the flat run ending at i - 1 was reached by a rise.
+    std::vector<std::uint8_t> plateauPeaks(const std::vector<int>& data) {
+      std::vector<std::uint8_t> peaks(data.size(), 0);
+      std::size_t runStart = 0;
+      for (std::size_t i = 1; i < data.size(); i++) {
+        if (data[i] < data[i - 1]) {
+          peaks[i] = runStart > 0 && data[runStart - 1] < data[runStart];
+        }
+        if (data[i] != data[i - 1]) runStart = i;
+      }
+      return peaks;
+    }
+
+    // Hysteresis as a plain state machine: from the start, look for a rise
+    // of delta over the lowest point so far, then for a fall of delta below
+    // the highest point since (the peak), and so on.
+    std::vector<std::uint8_t> prominencePeaks(const std::vector<int>& data,
+                                              std::int64_t delta) {
+      std::vector<std::uint8_t> peaks(data.size(), 0);
+      bool seekingPeak = false;
+      std::int64_t extreme = data.empty() ? 0 : data[0];
+      for (std::size_t i = 0; i < data.size(); i++) {
+        std::int64_t value = data[i];
+        if (seekingPeak) {
+          if (value > extreme) {
+            extreme = value;
+          } else if (value <= extreme - delta) {
+            peaks[i] = 1;
+            seekingPeak = false;
+            extreme = value;
+          }
+        } else {
+          if (value < extreme) {
+            extreme = value;
+          } else if (value >= extreme + delta) {
+            seekingPeak = true;
+            extreme = value;
+          }
+        }
+      }
+      return peaks;
+    }
+
+    // oldMain.cpp's PeakDetector over one full cycle of 100 samples starting
+    // at first: buffer[i] higher than both neighbours for i = 1..97.
+    std::uint32_t oldMainPeaks(const std::vector<int>& data,
+                               std::size_t first) {
+      const int* buffer = data.data() + first;
+      std::uint32_t peaksDetected = 0;
+      for (int i = 1; i < 98; ++i) {
+        if (buffer[i] > buffer[i - 1] && buffer[i] > buffer[i + 1]) {
+          peaksDetected++;
+        }
+      }
+      return peaksDetected;
+    }
+
+    struct Case {
+      std::uint64_t seed;
+      std::uint64_t number;
+      Config config;
+      Config other;        // second window of the multi-window variant
+      std::string shape;
+      std::vector<int> data;
+      std::mt19937_64 random;
+
+      std::vector<std::uint8_t> peaks;
+      Reference expected;
+      Reference otherExpected;
+    };
+
+    struct Divergence {
+      std::string variant;
+      std::size_t index;
+      std::string detail;
+    };
+
+    std::size_t below(std::mt19937_64& random, std::size_t bound) {
+      return bound == 0 ? 0 : random() % bound;
+    }
+
+    // Packet sizes around the boundaries the batch paths care about: single
+    // samples, peak words (64), kernel blocks (512) and slack runs.
+    // Note: after a stop the alarm is usually still on and the next call
+    // stops after one sample again, but a batch call finds the peaks of its
+    // packet (up to a block) before it starts, so those packets are mostly
+    // kept short to keep alarm heavy streams fast.
+    std::size_t packetSize(std::mt19937_64& random, std::size_t left,
+                           bool afterStop = false) {
+      static const std::size_t sizes[] = {1, 2, 7, 8, 63, 64, 65, 511, 512,
+                                          513, 1000, 4096};
+      static const std::size_t after_stop_size = 8;
+      if (afterStop && random() % 16 != 0) {
+        left = left < after_stop_size ? left : after_stop_size;
+      }
+      std::size_t size;
+      switch (random() % 4) {
+      case 0: size = sizes[random() % std::size(sizes)]; break;
+      case 1: size = 1 + below(random, 32); break;
+      case 2: size = 1 + below(random, 2048); break;
+      default: size = left; break;
+      }
+      return size < left ? size : left;
+    }
+
+    // Compares a processBatch-like call against the reference. batch(first,
+    // count) consumes samples [first, first + count) and returns the index
+    // of the sample it stopped at within them, or count; the stream is fed
+    // on from the sample after a stop, like a caller interested in every
+    // alarm would.
+    template <typename Batch>
+    std::optional<Divergence> checkBatches(Case& c, const std::string& variant,
+                                           Batch&& batch) {
+      std::size_t n = c.data.size();
+      std::size_t position = 0;
+      bool stopped = false;
+      while (position < n) {
+        std::size_t count = packetSize(c.random, n - position, stopped);
+        std::size_t stop = batch(position, count);
+        std::size_t next = c.expected.nextAlarm[position];
+        std::size_t expected = next < position + count ? next - position
+                                                       : count;
+        if (stop != expected) {
+          return Divergence{variant,
+                            position + (stop < expected ? stop : expected),
+                            "batch stopped at " + std::to_string(stop) +
+                              " instead of " + std::to_string(expected) +
+                              " (packet of " + std::to_string(count) +
+                              " from sample " + std::to_string(position) +
+                              ")"};
+        }
+        stopped = stop < count;
+        position += stopped ? stop + 1 : count;
+      }
+      return std::nullopt;
+    }
+
+    // processNewDataPoint one sample at a time; step(i) returns the alarm
+    // state after sample i.
+    template <typename Step>
+    std::optional<Divergence> checkSamples(Case& c, const std::string& variant,
+                                           Step&& step) {
+      for (std::size_t i = 0; i < c.data.size(); i++) {
+        bool alarm = step(i);
+        if (alarm != (bool)c.expected.alarms[i]) {
+          return Divergence{variant, i,
+                            std::string("alarm ") + (alarm ? "on" : "off") +
+                              " after the sample"};
+        }
+      }
+      return std::nullopt;
+    }
+
+    std::string describe(const AlarmEpisode& episode) {
+      return "[" + std::to_string(episode.start) + ", " +
+             std::to_string(episode.end) + ") min " +
+             std::to_string(episode.minPeakCount);
+    }
+
+    std::optional<Divergence> compareEpisodes(
+        const std::string& variant, const std::vector<AlarmEpisode>& found,
+        const std::vector<AlarmEpisode>& expected) {
+      for (std::size_t e = 0; e < found.size() || e < expected.size(); e++) {
+        if (e < found.size() && e < expected.size() &&
+            found[e] == expected[e]) {
+          continue;
+        }
+        std::size_t index = e < expected.size() ? expected[e].start
+                                                : found[e].start;
+        if (e < found.size() && e < expected.size() &&
+            found[e].start < index) {
+          index = found[e].start;
+        }
+        return Divergence{variant, index,
+                          "episode " + std::to_string(e) + " is " +
+                            (e < found.size() ? describe(found[e])
+                                              : "missing") +
+                            ", expected " +
+                            (e < expected.size() ? describe(expected[e])
+                                                 : "none")};
+      }
+      return std::nullopt;
+    }
+
+    // scanBatch over packets, plus the episode still open at the end.
+    template <typename Detector, typename Sample>
+    std::optional<Divergence> checkEpisodes(Case& c,
+                                            const std::string& variant,
+                                            Detector& detector,
+                                            const std::vector<Sample>& data) {
+      std::vector<AlarmEpisode> found;
+      std::size_t position = 0;
+      while (position < data.size()) {
+        std::size_t count = packetSize(c.random, data.size() - position);
+        detector.scanBatch(
+          std::span<const Sample>(data.data() + position, count),
+          [&](const AlarmEpisode& episode) {found.push_back(episode);});
+        position += count;
+      }
+      AlarmEpisode open;
+      if (detector.getOpenEpisode(open)) found.push_back(open);
+      return compareEpisodes(variant, found, c.expected.episodes);
+    }
+
+    template <typename Detector, typename Sample>
+    std::optional<Divergence> checkDetector(Case& c,
+                                            const std::string& variant,
+                                            Detector detector,
+                                            const std::vector<Sample>& data) {
+      return checkBatches(c, variant, [&](std::size_t first,
+                                          std::size_t count) {
+        return detector.processBatch(
+          std::span<const Sample>(data.data() + first, count));
+      });
+    }
+
+    // Deque detector that is saved and restored into a fresh detector (see
+    // Checkpoint.hpp) between some of its packets.
+    std::optional<Divergence> checkCheckpoints(Case& c) {
+      AnomalyDetector detector(c.config.windowSize, c.config.alarmPercentage);
+      return checkBatches(c, "deque/checkpoint", [&](std::size_t first,
+                                                     std::size_t count) {
+        if (c.random() % 8 == 0) {
+          std::vector<unsigned char> state(checkpoint::header_size);
+          checkpoint::Writer writer(state);
+          detector.saveState(writer);
+          AnomalyDetector restored(c.config.windowSize,
+                                   c.config.alarmPercentage);
+          checkpoint::Reader reader(std::span<const unsigned char>(
+            state.data() + checkpoint::header_size,
+            state.size() - checkpoint::header_size));
+          restored.restoreState(reader);
+          detector = restored;
+        }
+        return detector.processBatch(
+          std::span<const int>(c.data.data() + first, count));
+      });
+    }
+
+    // A counter a little wider than the window, so the detector renumbers
+    // its window (rebase) every few hundred or thousand samples.
+    template <typename Counter>
+    std::optional<Divergence> checkNarrowCounter(Case& c,
+                                                 const std::string& variant) {
+      BasicAnomalyDetector<DequePeakWindow, RuntimeThreshold,
+                           StrictPeakPolicy, Counter>
+        detector(c.config.windowSize, c.config.alarmPercentage);
+      return checkDetector(c, variant, detector, c.data);
+    }
+
+    // The peak count traced along processBatch calls that stop at every
+    // alarm, against the reference count of every traced sample.
+    std::optional<Divergence> checkTrace(Case& c) {
+      unsigned int every = 1 + (unsigned int)below(c.random, 150);
+      std::vector<std::uint32_t> values(c.data.size() / every + 1);
+      PeakTrace<std::uint32_t> trace{values, every};
+      RingAnomalyDetector detector(c.config.windowSize,
+                                   c.config.alarmPercentage);
+      std::string variant = "ring/trace:" + std::to_string(every);
+      std::optional<Divergence> divergence = checkBatches(c, variant,
+        [&](std::size_t first, std::size_t count) {
+          return detector.processBatch(
+            std::span<const int>(c.data.data() + first, count), trace);
+        });
+      if (divergence) return divergence;
+
+      if (trace.written != c.data.size() / every) {
+        return Divergence{variant, c.data.size(),
+                          "traced " + std::to_string(trace.written) +
+                            " counts"};
+      }
+      for (std::size_t k = 0; k < trace.written; k++) {
+        std::size_t sample = (k + 1) * every - 1;
+        if (values[k] != c.expected.counts[sample]) {
+          return Divergence{variant, sample,
+                            "traced count " + std::to_string(values[k]) +
+                              " instead of " +
+                              std::to_string(c.expected.counts[sample])};
+        }
+      }
+      return std::nullopt;
+    }
+
+    // A fleet slot that was used (with the stream reversed), destroyed and
+    // handed out again, so a reset that forgets anything shows up.
+    std::optional<Divergence> checkFleet(Case& c) {
+      DetectorFleet fleet(3, c.config.windowSize, c.config.alarmPercentage);
+      fleet.create();
+      DetectorFleet::Channel used = fleet.create();
+      std::vector<int> reversed(c.data.rbegin(), c.data.rend());
+      fleet[used].scanBatch(std::span<const int>(reversed));
+      fleet.destroy(used);
+      DetectorFleet::Channel channel = fleet.create();
+      return checkBatches(c, "fleet", [&](std::size_t first,
+                                          std::size_t count) {
+        return fleet[channel].processBatch(
+          std::span<const int>(c.data.data() + first, count));
+      });
+    }
+
+    // Every channel of the bank gets the stream (enough channels for the
+    // AVX2 lanes and the scalar tail), and every channel has to agree.
+    std::optional<Divergence> checkBank(Case& c) {
+      AnomalyDetectorBank bank(bank_channels, c.config.windowSize,
+                               c.config.alarmPercentage);
+      std::vector<int> frames(c.data.size() * bank_channels);
+      for (std::size_t i = 0; i < c.data.size(); i++) {
+        std::fill_n(frames.begin() + i * bank_channels, bank_channels,
+                    c.data[i]);
+      }
+      std::optional<Divergence> disagreement;
+      std::optional<Divergence> divergence = checkBatches(c, "bank",
+        [&](std::size_t first, std::size_t count) {
+          std::size_t stop = bank.processFrames(std::span<const int>(
+            frames.data() + first * bank_channels, count * bank_channels));
+          std::size_t last = first + (stop < count ? stop : count - 1);
+          for (std::size_t channel = 0; channel < bank_channels; channel++) {
+            if (bank.getAlarmActive(channel) != (bool)c.expected.alarms[last]
+                && !disagreement) {
+              disagreement = Divergence{"bank", last,
+                                        "channel " + std::to_string(channel) +
+                                          " disagrees"};
+            }
+          }
+          return stop;
+        });
+      return divergence ? divergence : disagreement;
+    }
+
+    // Two windows over one stream: stops where either is in alarm, and each
+    // window's own state has to match its reference at every stop.
+    std::optional<Divergence> checkMultiWindow(Case& c) {
+      MultiWindowAnomalyDetector detector{
+        WindowConfig{c.config.windowSize, c.config.alarmPercentage},
+        WindowConfig{c.other.windowSize, c.other.alarmPercentage}};
+      std::string variant = "multi/" + std::to_string(c.other.windowSize) +
+                            ":" + std::to_string(c.other.alarmPercentage);
+      std::size_t n = c.data.size();
+      std::size_t position = 0;
+      bool stopped = false;
+      while (position < n) {
+        std::size_t count = packetSize(c.random, n - position, stopped);
+        std::size_t stop = detector.processBatch(
+          std::span<const int>(c.data.data() + position, count));
+        std::size_t next = std::min(c.expected.nextAlarm[position],
+                                    c.otherExpected.nextAlarm[position]);
+        std::size_t expected = next < position + count ? next - position
+                                                       : count;
+        std::size_t last = position + (stop < count ? stop : count - 1);
+        if (stop != expected ||
+            detector.getAlarmActive(0) != (bool)c.expected.alarms[last] ||
+            detector.getAlarmActive(1) !=
+              (bool)c.otherExpected.alarms[last]) {
+          return Divergence{variant,
+                            position + (stop < expected ? stop : expected),
+                            "batch stopped at " + std::to_string(stop) +
+                              " instead of " + std::to_string(expected) +
+                              ", alarm mask " +
+                              std::to_string(detector.getAlarmMask())};
+        }
+        stopped = stop < count;
+        position += stopped ? stop + 1 : count;
+      }
+      return std::nullopt;
+    }
+
+    // The stream as datagrams of a few consecutive samples, shuffled no
+    // further than the buffer can put back, through a ReorderBuffer into
+    // scanBatch. Nothing may be dropped or given up on.
+    std::optional<Divergence> checkReorder(Case& c) {
+      std::size_t capacity = 1 + below(c.random, 512);
+      std::size_t datagram = 1 + below(c.random, 16);
+      std::size_t runSize = 1 + below(c.random, 1500);
+      std::uint64_t firstSequence = c.random() % 2 ? 0 : c.random() >> 8;
+      if (datagram > capacity) datagram = capacity;
+      std::size_t group = capacity / datagram;
+
+      std::vector<std::size_t> order;
+      for (std::size_t i = 0; i < c.data.size(); i += datagram) {
+        order.push_back(i);
+      }
+      for (std::size_t g = 0; g < order.size(); g += group) {
+        std::shuffle(order.begin() + g,
+                     order.begin() + std::min(g + group, order.size()),
+                     c.random);
+      }
+
+      std::string variant = "reorder/" + std::to_string(capacity) + "x" +
+                            std::to_string(datagram);
+      ReorderBuffer<int> buffer(capacity, GapPolicy::wait, firstSequence,
+                                runSize);
+      RingAnomalyDetector detector(c.config.windowSize,
+                                   c.config.alarmPercentage);
+      std::vector<AlarmEpisode> found;
+      auto onRun = [&](std::span<const int> run) {
+        detector.scanBatch(run, [&](const AlarmEpisode& episode) {
+          found.push_back(episode);
+        });
+      };
+      for (std::size_t first : order) {
+        std::size_t count = std::min(datagram, c.data.size() - first);
+        buffer.push(firstSequence + first,
+                    std::span<const int>(c.data.data() + first, count), onRun);
+        if (c.random() % 4 == 0) buffer.release(onRun);
+      }
+      buffer.flush(onRun);
+
+      const ReorderCounters& counters = buffer.getCounters();
+      if (counters.dropped() + counters.skipped + counters.interpolated > 0 ||
+          detector.getSamplesConsumed() != c.data.size()) {
+        return Divergence{variant, (std::size_t)detector.getSamplesConsumed(),
+                          "dropped " + std::to_string(counters.dropped()) +
+                            ", skipped " + std::to_string(counters.skipped)};
+      }
+      AlarmEpisode open;
+      if (detector.getOpenEpisode(open)) found.push_back(open);
+      return compareEpisodes(variant, found, c.expected.episodes);
+    }
+
+    // A peak policy against its own reference peaks (same window rules).
+    template <typename Policy>
+    std::optional<Divergence> checkPolicy(Case& c, const std::string& variant,
+                                          std::vector<std::uint8_t> peaks) {
+      Reference strict = std::move(c.expected);
+      c.expected = reference(peaks, c.config);
+      PolicyAnomalyDetector<Policy> detector(c.config.windowSize,
+                                             c.config.alarmPercentage);
+      std::optional<Divergence> divergence =
+        checkDetector(c, variant, detector, c.data);
+      if (!divergence) {
+        PolicyAnomalyDetector<Policy> scanner(c.config.windowSize,
+                                              c.config.alarmPercentage);
+        divergence = checkEpisodes(c, variant + "/episodes", scanner, c.data);
+      }
+      c.expected = std::move(strict);
+      return divergence;
+    }
+
+    // Compile time configurations, run when a case draws one of them.
+    template <unsigned int WindowSize, unsigned int AlarmPercentage>
+    std::optional<Divergence> checkStatic(Case& c) {
+      using Detector = StaticAnomalyDetector<WindowSize, AlarmPercentage>;
+      return checkDetector(c, "static", Detector(), c.data);
+    }
+
+    struct StaticConfig {
+      Config config;
+      std::optional<Divergence> (*check)(Case&);
+    };
+
+    const StaticConfig static_configs[] = {
+      {{100, 25}, checkStatic<100, 25>}, {{1, 100}, checkStatic<1, 100>},
+      {{3, 50}, checkStatic<3, 50>},     {{64, 25}, checkStatic<64, 25>},
+      {{65, 33}, checkStatic<65, 33>},   {{128, 10}, checkStatic<128, 10>},
+      {{129, 50}, checkStatic<129, 50>}, {{200, 25}, checkStatic<200, 25>},
+      {{1000, 30}, checkStatic<1000, 30>}};
+
+    // Runs every variant over the case, stopping at the first divergence.
+    std::optional<Divergence> runCase(Case& c) {
+      c.peaks = strictPeaks(c.data);
+      c.expected = reference(c.peaks, c.config);
+      c.otherExpected = reference(c.peaks, c.other);
+      unsigned int windowSize = c.config.windowSize;
+      unsigned int alarmPercentage = c.config.alarmPercentage;
+      std::optional<Divergence> divergence;
+
+      // oldMain.cpp counted peaks over each full cycle of 100 samples. Its
+      // count covers the peaks at 1..97 of the cycle; the window ending on
+      // the cycle's last sample also has the peaks confirmed by its first
+      // two samples (at -1 and 0) and the one at 98, confirmed by sample 99.
+      if (windowSize == 100) {
+        for (std::size_t first = 0; first + 100 <= c.data.size();
+             first += 100) {
+          std::uint32_t count = oldMainPeaks(c.data, first) +
+                                c.peaks[first] + c.peaks[first + 1] +
+                                c.peaks[first + 99];
+          if (count != c.expected.counts[first + 99]) {
+            return Divergence{"oldMain", first + 99,
+                              "cycle count maps to " + std::to_string(count) +
+                                ", window has " +
+                                std::to_string(c.expected.counts[first + 99])};
+          }
+        }
+      }
+
+      divergence = checkSamples(c, "deque/sample",
+        [detector = AnomalyDetector(windowSize, alarmPercentage),
+         &c](std::size_t i) mutable {
+          detector.processNewDataPoint(c.data[i]);
+          return detector.getAlarmActive();
+        });
+      if (divergence) return divergence;
+      divergence = checkSamples(c, "multi/sample",
+        [detector = MultiWindowAnomalyDetector{WindowConfig{windowSize,
+                                                           alarmPercentage}},
+         &c](std::size_t i) mutable {
+          detector.processNewDataPoint(c.data[i]);
+          return detector.getAlarmActive(0);
+        });
+      if (divergence) return divergence;
+      divergence = checkSamples(c, "fused/sample",
+        [detector = FusedAnomalyDetector(windowSize, alarmPercentage),
+         &c](std::size_t i) mutable {
+          detector.processNewDataPoint(c.data[i]);
+          return detector.getAlarmActive();
+        });
+      if (divergence) return divergence;
+
+      divergence = checkDetector(c, "deque",
+        AnomalyDetector(windowSize, alarmPercentage), c.data);
+      if (divergence) return divergence;
+      RingAnomalyDetector ring(windowSize, alarmPercentage);
+      bool slack = c.random() % 2;
+      ring.setSlackSkipping(slack);
+      divergence = checkDetector(c, slack ? "ring" : "ring/no-slack", ring,
+                                 c.data);
+      if (divergence) return divergence;
+      RingAnomalyDetector scanner(windowSize, alarmPercentage);
+      divergence = checkEpisodes(c, "ring/episodes", scanner, c.data);
+      if (divergence) return divergence;
+      divergence = checkDetector(c, "fused",
+        FusedAnomalyDetector(windowSize, alarmPercentage), c.data);
+      if (divergence) return divergence;
+
+      divergence = checkCheckpoints(c);
+      if (divergence) return divergence;
+      divergence = windowSize < 255
+        ? checkNarrowCounter<std::uint8_t>(c, "deque/counter:8")
+        : checkNarrowCounter<std::uint16_t>(c, "deque/counter:16");
+      if (divergence) return divergence;
+      divergence = checkTrace(c);
+      if (divergence) return divergence;
+
+      std::vector<std::int64_t> wide(c.data.begin(), c.data.end());
+      divergence = checkDetector(c, "typed/int64",
+        TypedAnomalyDetector<std::int64_t>(windowSize, alarmPercentage),
+        wide);
+      if (divergence) return divergence;
+      std::vector<double> doubles(c.data.begin(), c.data.end());
+      divergence = checkDetector(c, "typed/double",
+        TypedAnomalyDetector<double>(windowSize, alarmPercentage), doubles);
+      if (divergence) return divergence;
+      // Note: only streams a float holds exactly, or rounding adds ties
+      bool exact = std::all_of(c.data.begin(), c.data.end(), [](int value) {
+        return value > -(1 << 24) && value < (1 << 24);
+      });
+      if (exact) {
+        std::vector<float> floats(c.data.begin(), c.data.end());
+        divergence = checkDetector(c, "typed/float",
+          TypedAnomalyDetector<float>(windowSize, alarmPercentage), floats);
+        if (divergence) return divergence;
+      }
+
+      for (const StaticConfig& config : static_configs) {
+        if (config.config.windowSize == windowSize &&
+            config.config.alarmPercentage == alarmPercentage) {
+          divergence = config.check(c);
+          if (divergence) return divergence;
+        }
+      }
+
+      divergence = checkFleet(c);
+      if (divergence) return divergence;
+      divergence = checkBank(c);
+      if (divergence) return divergence;
+      divergence = checkMultiWindow(c);
+      if (divergence) return divergence;
+      divergence = checkReorder(c);
+      if (divergence) return divergence;
+
+      divergence = checkPolicy<StrictPeakPolicy>(c, "policy/strict", c.peaks);
+      if (divergence) return divergence;
+      divergence = checkPolicy<PlateauPeakPolicy>(c, "policy/plateau",
+                                                  plateauPeaks(c.data));
+      if (divergence) return divergence;
+      return checkPolicy<ProminencePeakPolicy<prominence_delta>>(
+        c, "policy/prominence", prominencePeaks(c.data, prominence_delta));
+    }
+
+    // Streams. Apart from the generator's regimes they are the shapes that
+    // sit on the edges of the peak rule and the threshold.
+    const char* const shapes[] = {
+      "healthy", "degraded", "levels", "switching", "oldMain", "threshold",
+      "plateaus", "extremes", "flat", "rising", "falling", "alternating",
+      "sawtooth", "mixed"};
+
+    void fillShape(const std::string& shape, std::span<int> out,
+                   Config config, std::mt19937_64& random) {
+      std::size_t n = out.size();
+      if (shape == "healthy") {
+        StreamGenerator(random()).fill(0, out);
+      } else if (shape == "degraded") {
+        StreamGenerator(random(), Regime::degraded()).fill(0, out);
+      } else if (shape == "levels") {
+        Regime regime{2 + (unsigned int)below(random, 5)};
+        StreamGenerator(random(), regime).fill(0, out);
+      } else if (shape == "switching") {
+        double leave = 1.0 / (1 + below(random, 2000));
+        StreamGenerator(random(), Regime::healthy(), Regime::degraded(),
+                        leave, leave * 4).fill(0, out);
+      } else if (shape == "oldMain") {
+        for (int& value : out) value = (int)(random() % 100);
+      } else if (shape == "threshold") {
+        // zigzags (one peak per two samples) between flat stretches, at a
+        // peak rate within a few percent of the alarm percentage
+        double rate = config.alarmPercentage / 100.0 *
+                      (0.9 + 0.2 * (random() % 1001) / 1000.0);
+        double zigzag = rate >= 0.5 ? 1.0 : rate / (1 - rate);
+        std::bernoulli_distribution peak(zigzag);
+        int level = (int)below(random, 7) - 3;
+        for (std::size_t i = 0; i < n; i++) {
+          if (peak(random) && i + 1 < n) {
+            out[i++] = level + 1;
+          }
+          out[i] = level;
+        }
+      } else if (shape == "plateaus") {
+        std::size_t i = 0;
+        while (i < n) {
+          int value = (int)below(random, 5);
+          std::size_t run = 1 + below(random, 8);
+          for (; run > 0 && i < n; run--) out[i++] = value;
+        }
+      } else if (shape == "extremes") {
+        static const int values[] = {INT_MIN, INT_MIN + 1, -1, 0, 1,
+                                     INT_MAX - 1, INT_MAX};
+        for (int& value : out) value = values[random() % std::size(values)];
+      } else if (shape == "flat") {
+        std::fill(out.begin(), out.end(), (int)random());
+      } else if (shape == "rising" || shape == "falling") {
+        int step = shape == "rising" ? 1 : -1;
+        for (std::size_t i = 0; i < n; i++) out[i] = step * (int)i;
+      } else if (shape == "alternating") {
+        // 1,0,1,0 (every other sample a peak) with the odd sample flipped
+        std::size_t flips = below(random, 8);
+        for (std::size_t i = 0; i < n; i++) out[i] = 1 - (int)(i % 2);
+        for (; flips > 0 && n > 0; flips--) out[below(random, n)] ^= 1;
+      } else if (shape == "sawtooth") {
+        std::size_t period = 2 + below(random, 2 * config.windowSize + 2);
+        for (std::size_t i = 0; i < n; i++) out[i] = (int)(i % period);
+      } else {
+        // mixed: segments of the other shapes, a window or so long each
+        std::size_t i = 0;
+        while (i < n) {
+          std::size_t length = 1 + below(random, 3 * config.windowSize);
+          if (length > n - i) length = n - i;
+          const char* part = shapes[random() % (std::size(shapes) - 1)];
+          fillShape(part, out.subspan(i, length), config, random);
+          i += length;
+        }
+      }
+    }
+
+    Config randomConfig(std::mt19937_64& random) {
+      static const unsigned int percentages[] = {0, 1, 25, 33, 50, 99, 100};
+      if (random() % 4 == 0) {
+        return static_configs[random() % std::size(static_configs)].config;
+      }
+      unsigned int windowSize;
+      switch (random() % 5) {
+      case 0: windowSize = 1 + (unsigned int)below(random, 4); break;
+      case 1: windowSize = 100; break;
+      case 2: windowSize = 1 + (unsigned int)below(random, 5000); break;
+      default: windowSize = 1 + (unsigned int)below(random, 300); break;
+      }
+      // Note: otherwise around the healthy peak rate (~33%), where the
+      // random streams go in and out of alarm
+      unsigned int alarmPercentage = random() % 2
+        ? percentages[random() % std::size(percentages)]
+        : (unsigned int)below(random, 41);
+      return Config{windowSize, alarmPercentage};
+    }
+
+    Case makeCase(std::uint64_t seed, std::uint64_t number) {
+      std::seed_seq sequence{(std::uint32_t)seed, (std::uint32_t)(seed >> 32),
+                             (std::uint32_t)number,
+                             (std::uint32_t)(number >> 32)};
+      Case c{seed, number, {}, {}, "", {}, std::mt19937_64(sequence), {}, {},
+             {}};
+      c.config = randomConfig(c.random);
+      c.other = randomConfig(c.random);
+      c.shape = shapes[c.random() % std::size(shapes)];
+
+      std::uint64_t budget = reference_budget /
+        std::max(c.config.windowSize, c.other.windowSize);
+      std::size_t limit = std::min<std::uint64_t>(budget, max_stream_size);
+      std::size_t size = c.random() % 2
+        ? below(c.random, 4 * std::size_t(c.config.windowSize) + 2)
+        : below(c.random, limit + 1);
+      c.data.resize(std::min(size, limit));
+      fillShape(c.shape, c.data, c.config, c.random);
+      return c;
+    }
+
+    // Little-endian int32 per sample, like AnomalyDetector capture ... raw.
+    std::string writeReplay(const Case& c) {
+      std::string path = "fuzz-" + std::to_string(c.seed) + "-" +
+                         std::to_string(c.number) + ".raw";
+      std::ofstream out(path, std::ios::binary);
+      out.write((const char*)c.data.data(), c.data.size() * sizeof(int));
+      return out ? path : "(could not write " + path + ")";
+    }
+
+    std::string report(const Case& c, const Divergence& divergence) {
+      std::ostringstream text;
+      text << "DIVERGENCE in " << divergence.variant << " at sample "
+           << divergence.index << ": " << divergence.detail << "\n"
+           << "  case " << c.number << " of seed " << c.seed << ", window "
+           << c.config.windowSize << " at " << c.config.alarmPercentage
+           << "%, " << c.shape << " stream of " << c.data.size()
+           << " samples\n"
+           << "  rerun: AnomalyDetector_fuzz 0 " << c.seed << " 1 "
+           << c.number;
+      return text.str();
+    }
+}
+
+#if defined(ANOMALY_DETECTOR_LIBFUZZER)
+
+// libFuzzer entry (clang -fsanitize=fuzzer, see CMakeLists.txt): the first
+// four bytes pick the window, the percentage and the packet sizes, the rest
+// are the samples, int32 or (for more ties) int8 each.
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* bytes,
+                                      std::size_t size) {
+  if (size < 4) return 0;
+  fuzz::Case c{0, 0, {}, {}, "libfuzzer", {}, std::mt19937_64(bytes[3]),
+               {}, {}, {}};
+  c.config = fuzz::Config{1 + ((bytes[0] | bytes[1] << 8) % 1024u),
+                          bytes[2] % 101u};
+  c.other = fuzz::Config{100, 25};
+  bool narrow = bytes[3] & 1;
+  std::size_t width = narrow ? 1 : sizeof(int);
+  std::size_t count = std::min<std::size_t>((size - 4) / width,
+                                            fuzz::reference_budget /
+                                              c.config.windowSize);
+  for (std::size_t i = 0; i < count; i++) {
+    int value;
+    if (narrow) {
+      value = (std::int8_t)bytes[4 + i];
+    } else {
+      std::memcpy(&value, bytes + 4 + i * width, sizeof(int));
+    }
+    c.data.push_back(value);
+  }
+
+  std::optional<fuzz::Divergence> divergence = fuzz::runCase(c);
+  if (divergence) {
+    std::cerr << fuzz::report(c, *divergence) << std::endl;
+    std::abort();
+  }
+  return 0;
+}
+
+#else
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? std::stod(argv[1]) : 10;
+    std::uint64_t seed = argc > 2 ? std::stoull(argv[2]) : time(0);
+    unsigned int threads = argc > 3 ? std::stoul(argv[3])
+                                    : std::thread::hardware_concurrency();
+    std::uint64_t firstCase = argc > 4 ? std::stoull(argv[4]) : 0;
+    if (threads < 1) threads = 1;
+    // Note: seconds 0 replays the single case firstCase
+    if (seconds <= 0) threads = 1;
+
+    std::cout << "Fuzzing with seed " << seed << " from case " << firstCase
+              << " on " << threads << " threads" << std::endl;
+
+    std::atomic<bool> stop{false};
+    std::atomic<std::uint64_t> cases{0};
+    std::atomic<std::uint64_t> samples{0};
+    std::mutex reportMutex;
+    std::string failure;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration<double>(seconds);
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads; t++) {
+      workers.emplace_back([&, t] {
+        for (std::uint64_t number = firstCase + t; !stop;
+             number += threads) {
+          fuzz::Case c = fuzz::makeCase(seed, number);
+          std::optional<fuzz::Divergence> divergence = fuzz::runCase(c);
+          cases++;
+          samples += c.data.size();
+          if (divergence) {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            if (failure.empty()) {
+              failure = fuzz::report(c, *divergence) + "\n  stream: " +
+                        fuzz::writeReplay(c);
+            }
+            stop = true;
+          }
+          if (seconds <= 0 || std::chrono::steady_clock::now() >= deadline) {
+            stop = true;
+          }
+        }
+      });
+    }
+
+    // progress every few seconds, so an overnight run shows it is alive
+    auto lastReport = start;
+    while (!stop) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      auto now = std::chrono::steady_clock::now();
+      if (now - lastReport >= std::chrono::seconds(10)) {
+        lastReport = now;
+        std::chrono::duration<double> elapsed = now - start;
+        std::cout << std::fixed << std::setprecision(0) << elapsed.count()
+                  << "s: " << cases << " cases, " << samples
+                  << " samples (" << std::setprecision(1)
+                  << samples / elapsed.count() / 1e6 << " M/s)" << std::endl;
+      }
+    }
+    for (std::thread& worker : workers) worker.join();
+
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    std::cout << std::fixed << std::setprecision(1) << "Checked " << cases
+              << " cases, " << samples << " samples through every variant in "
+              << elapsed.count() << "s (" << samples / elapsed.count() / 1e6
+              << " M samples/s)" << std::endl;
+    if (!failure.empty()) {
+      std::cout << failure << std::endl;
+      return 1;
+    }
+    std::cout << "No divergence" << std::endl;
+    return 0;
+}
+
+#endif
+
+// NOTE: README.md contains summary docs
\ No newline at end of file
@@ -22,127 +22,58 @@
 #include <cstdlib>
 #include <ctime>
 #include <climits>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <deque>
-#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
 
-// To intern: we define defaults here to make the code reusable/generalizable
+#include "AnomalyDetector.hpp"
+#include "Checkpoint.hpp"
+#include "CommandLine.hpp"
+#include "ReplayFile.hpp"
+#include "ShardedRuntime.hpp"
+#include "SocketPipeline.hpp"
+#include "SpscRingBuffer.hpp"
+#include "StreamGenerator.hpp"
+#include "TextInput.hpp"
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+// To intern: detector defaults live in AnomalyDetector.hpp, the ones below
+// only matter for this test driver.
 namespace defaults
 {
-    static const unsigned int window_size = 100;
-    static const unsigned int alarm_percentage = 25;
-    // below is for testing
     static const bool use_time_seed = true;
     static const unsigned int set_seed = 1673353513;
     static const bool use_random = true;
 }
 
-// To intern: Class instead of namespace for reusabiltiy
-class AnomalyDetector {
-private:
-  int prevPoint = 0;
-  bool prevIsPossiblePeak = false;
-  unsigned int datumNum = 0;
-  bool overflowOccured = false;
-  bool alarmActive = false;
-
-  // To intern: only storing relevant peaks saves space and time (constant time
-  // insertion/deletion at front and back).
-
-  // Notes: if the application requires more implementation details like
-  // copy constructors, destructors, iterators, etc. Then it might make sense to
-  // have the deque be public. This may cause unwanted access to other methods.
-  std::deque<unsigned int> peaksInWindow;
-  unsigned int windowSize;
-  unsigned int alarmPercentage;
-
-  void incrementDatumNum(){
-    // To intern: resetting all time step vals but keeping relative order
-    if (datumNum == UINT_MAX){
-      overflowOccured = true;
-
-      int offset = UINT_MAX - windowSize;
-
-      // modifying all recent peaks
-      for (int i = 0; i < peaksInWindow.size(); i++) {
-        peaksInWindow[i] -= offset;
-      }
-      // modifying datanum itself. Subtracting 1 more because next line adds 1
-      datumNum -= (offset + 1);
-    }
-    
-    datumNum++;
-  }
-
-  // To intern: if peak falls outside of window it is no longer relevant so we
-  // delete it from our queue.
-  // Note: the implementation here is nice because we could easily change the
-  // code to instead work on the last 100 seconds of datapoints instead of just
-  // the last 100 datapoints. The pruning would be time based as would the
-  // inserting of peaks.
-  void pruneOldPeaks() {
-    bool tooFewDataPoints = datumNum < windowSize;
-    bool peaksDequeEmpty = !peaksInWindow.empty();
-    if (tooFewDataPoints || peaksDequeEmpty) return;
-
-    int lowerLimit = datumNum - windowSize;
-    while (peaksInWindow.back() <= lowerLimit) peaksInWindow.pop_back();
-  }
-
-  // To intern: this is how to check for peaks as we consume the stream
-  void checkIfPeakCreated(int dataPoint) {
-    if (dataPoint < prevPoint && prevIsPossiblePeak) {
-      peaksInWindow.push_front(datumNum);
-    }
-  }
-
-  // To intern: deriving minimumPeaks good for reusability/generalization. Also
-  // we check minDataReceived because we need to have enough datapoints before
-  // checking if there is an anomaly.
-  void checkForAnomaly() {
-    int minimumPeaks = ceil(windowSize * (alarmPercentage / 100.0)) ;
-    bool peaksBelowThreshold = peaksInWindow.size() < minimumPeaks;
-    bool minDataReceived = datumNum >= windowSize;
-
-    alarmActive = minDataReceived && peaksBelowThreshold;
-  }
-
-public:
-  // To intern: large integrating functions should be highly readable.
-  void processNewDataPoint(int dataPoint) {
-    incrementDatumNum();
-    pruneOldPeaks();
-    checkIfPeakCreated(dataPoint);
-
-    checkForAnomaly();
-
-    prevIsPossiblePeak = dataPoint > prevPoint && datumNum > 1;
-    prevPoint = dataPoint;
-  }
-
-  // getters
-  bool getAlarmActive() {return alarmActive;}
-  bool getOverflowOccured() {return overflowOccured;}
-  int getDatumNum() {return datumNum;}
-
-  // To intern: by allowing for params we add reuasbility.
-
-  // Note: We should be checking the inputs to prevent underflow since we are
-  // dealing with unsigned ints
-  AnomalyDetector(unsigned int windowSize = defaults::window_size,
-                  unsigned int alarmPercentage = defaults::alarm_percentage) {
-    this->windowSize = windowSize;
-    this->alarmPercentage = alarmPercentage;
-  }
-};  
-
 /* EVERYTHING BELOW IS FOR TESTING */
 
+using command_line::readArgument;
+
 // To intern: it was never specified that all stream values would be nonnegative
 // so it is important to include negative values as we test.
-// Note: It would be cool in the future to implement sampling from a custom
-// distribution that more accurately reflects the real-world data.
+// Note: samples come from StreamGenerator.hpp (healthy regime, ~33% peaks)
+// instead of std::rand, which had a small range, global state and was not
+// usable from several threads. Other regimes and Markov switching between
+// them are available there.
+StreamCursor randomStream(StreamGenerator(defaults::set_seed));
+
+void seedRandom(unsigned int seed) {
+  randomStream = StreamCursor(StreamGenerator(seed));
+}
+
 int getFromRandom() {
-  return std::rand() - (RAND_MAX / 2);
+  return randomStream.next();
 }
 
 // To intern: to better test corner cases or investigate errors we should have
@@ -161,7 +92,447 @@ int getFromList() {
   return ret;
 }
 
-int main() {
+// Throughput of ShardedAnomalyRuntime from 1 thread up to every hardware
+// thread. Every 8th channel is "hot" and gets 8x the samples of the others so
+// work stealing has something to rebalance. Input is generated up front so
+// only detection is timed, and the per-channel reports of every run are
+// compared against the single threaded run.
+// Usage: AnomalyDetector sharded [channels] [samples per channel per round]
+int runSharded(int argc, char* argv[]) {
+    std::size_t channels = 4096;
+    std::size_t baseSamples = 1024;
+    if (!readArgument(argc, argv, 2, "channels", 1, UINT32_MAX, channels) ||
+        !readArgument(argc, argv, 3, "samples per channel", 1, UINT32_MAX,
+                      baseSamples)) {
+      std::cerr << "usage: AnomalyDetector sharded [channels] "
+                << "[samples per channel per round]" << std::endl;
+      return 2;
+    }
+    const unsigned int rounds = 8;
+    const std::size_t hotFactor = 8;
+
+    StreamGenerator generator(defaults::set_seed);
+    std::vector<std::vector<int>> data(channels);
+    std::vector<std::span<const int>> slices(channels);
+    std::size_t samplesPerRound = 0;
+    for (std::size_t c = 0; c < channels; c++) {
+      data[c].resize(c % 8 == 0 ? baseSamples * hotFactor : baseSamples);
+      generator.fill(samplesPerRound, data[c]);
+      slices[c] = data[c];
+      samplesPerRound += data[c].size();
+    }
+
+    unsigned int maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0) maxThreads = 1;
+
+    std::vector<ShardedAnomalyRuntime::ChannelReport> reference;
+    bool deterministic = true;
+    std::cout << "channels: " << channels << ", samples per round: "
+              << samplesPerRound << ", rounds: " << rounds << std::endl;
+    for (unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+      ShardedAnomalyRuntime runtime(channels, threads);
+
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned int r = 0; r < rounds; r++) runtime.processRound(slices);
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+      auto reports = runtime.getReports();
+      if (reference.empty()) {
+        reference.assign(reports.begin(), reports.end());
+      } else if (!std::equal(reports.begin(), reports.end(),
+                             reference.begin())) {
+        deterministic = false;
+      }
+
+      double samples = double(samplesPerRound) * rounds;
+      std::cout << "threads: " << threads << "\t"
+                << samples / elapsed.count() / 1e6 << " M samples/s"
+                << std::endl;
+      if (threads < maxThreads && threads * 2 > maxThreads) {
+        threads = maxThreads / 2;
+      }
+    }
+    std::cout << "per-channel results identical across thread counts: "
+              << (deterministic ? "yes" : "NO") << std::endl;
+    return deterministic ? 0 : 1;
+}
+
+// Same test as the default mode, but the data source runs on its own thread
+// and hands samples to the detector through an SpscRingBuffer, like a network
+// receive thread would. The consumer drains whole chunks into processBatch
+// and samples how full the queue is on every drain to show backpressure.
+// Usage: AnomalyDetector pipeline [queue capacity] [chunk size]
+int runPipeline(int argc, char* argv[]) {
+    std::size_t capacity = 1 << 16;
+    std::size_t chunk = 4096;
+    if (!readArgument(argc, argv, 2, "queue capacity", 1, 1 << 30,
+                      capacity) ||
+        !readArgument(argc, argv, 3, "chunk size", 1, 1 << 30, chunk)) {
+      std::cerr << "usage: AnomalyDetector pipeline [queue capacity] "
+                << "[chunk size]" << std::endl;
+      return 2;
+    }
+
+    unsigned int seed = defaults::use_time_seed ? time(0) : defaults::set_seed;
+    seedRandom(seed);
+
+    SpscRingBuffer<int> queue(capacity);
+    std::atomic<bool> done{false};
+
+    // To intern: only the producer touches randomStream, so it is safe to
+    // use from this thread.
+    std::thread producer([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        std::span<int> room = queue.acquireWrite(chunk);
+        if (room.empty()) {
+          std::this_thread::yield();
+          continue;
+        }
+        randomStream.fill(room);
+        queue.commitWrite(room.size());
+      }
+    });
+
+    AnomalyDetector detector = AnomalyDetector();
+    std::size_t drains = 0;
+    std::size_t fillSum = 0;
+    std::size_t fillMax = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (!detector.getAlarmActive()) {
+      std::size_t fill = queue.size();
+      std::span<const int> samples = queue.acquireRead(chunk);
+      if (samples.empty()) {
+        std::this_thread::yield();
+        continue;
+      }
+      drains++;
+      fillSum += fill;
+      fillMax = std::max(fillMax, fill);
+
+      std::size_t alarmAt = detector.processBatch(samples);
+      queue.release(alarmAt < samples.size() ? alarmAt + 1 : samples.size());
+    }
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    done.store(true, std::memory_order_relaxed);
+    producer.join();
+
+    std::cout << std::endl;
+    std::cout << "Random seed used: " << seed << std::endl;
+    std::cout << "Anomaly detected after "
+              << (detector.getOverflowOccured()
+                ? std::to_string(std::numeric_limits<
+                    decltype(detector.getDatumNum())>::max()) + "+"
+                : std::to_string(detector.getDatumNum()))
+              << " data points." << std::endl;
+    std::cout << "Throughput: "
+              << detector.getDatumNum() / elapsed.count() / 1e6
+              << " M samples/s" << std::endl;
+    std::cout << "Queue fill (of " << queue.capacity() << "): average "
+              << (drains ? fillSum / drains : 0) << ", max " << fillMax
+              << std::endl;
+    std::cout << std::endl;
+    return 0;
+}
+
+// SocketPipeline over local sockets: a feeder thread stands in for the
+// remote senders and writes every stream's samples into its own socket pair,
+// a few hundred bytes at a time and round robin over the streams (so samples
+// are split across reads), while this thread serves all streams. The alarm
+// episodes of every stream are checked against scanBatch over the same
+// samples.
+// Usage: AnomalyDetector sockets [streams] [samples per stream]
+int runSockets(int argc, char* argv[]) {
+    std::size_t streams = 1000;
+    std::size_t samplesPerStream = 100000;
+    if (!readArgument(argc, argv, 2, "streams", 1, 1 << 20, streams) ||
+        !readArgument(argc, argv, 3, "samples per stream", 0, UINT32_MAX,
+                      samplesPerStream)) {
+      std::cerr << "usage: AnomalyDetector sockets [streams] "
+                << "[samples per stream]" << std::endl;
+      return 2;
+    }
+    const std::size_t write_bytes = 1002;
+
+    // two descriptors per stream, more than the usual soft limit of 1024
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    std::vector<std::vector<AlarmEpisode>> expected(streams);
+    std::vector<std::vector<AlarmEpisode>> received(streams);
+    std::vector<int> writers(streams);
+    try {
+      SocketPipeline pipeline(
+        [&](SocketPipeline::Stream stream, const AlarmEpisode& episode) {
+          received[stream].push_back(episode);
+        });
+      for (std::size_t s = 0; s < streams; s++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+          throw std::runtime_error("socketpair failed after " +
+                                   std::to_string(s) + " streams: " +
+                                   std::strerror(errno));
+        }
+        pipeline.addStream(pair[0]);
+        writers[s] = pair[1];
+      }
+
+      StreamGenerator generator(defaults::set_seed);
+      std::vector<std::vector<int>> data(streams);
+      for (std::size_t s = 0; s < streams; s++) {
+        data[s].resize(samplesPerStream);
+        generator.fill(s * samplesPerStream, data[s]);
+        RingAnomalyDetector detector;
+        expected[s] = detector.scanBatch(data[s]);
+        AlarmEpisode open;
+        if (detector.getOpenEpisode(open)) expected[s].push_back(open);
+      }
+
+      std::thread feeder([&] {
+        std::vector<std::size_t> written(streams, 0);
+        std::size_t remaining = streams;
+        if (samplesPerStream == 0) {
+          for (int writer : writers) close(writer);
+          remaining = 0;
+        }
+        while (remaining > 0) {
+          for (std::size_t s = 0; s < streams; s++) {
+            std::size_t total = data[s].size() * sizeof(int);
+            if (written[s] == total) continue;
+            std::size_t count = std::min(write_bytes, total - written[s]);
+            // Note: MSG_NOSIGNAL, so a pipeline that stopped reading fails
+            // the send with EPIPE instead of killing the process (SIGPIPE)
+            ssize_t sent = send(writers[s],
+              reinterpret_cast<const char*>(data[s].data()) + written[s],
+              count, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0) sent = total - written[s];   // reader is gone
+            written[s] += sent;
+            if (written[s] == total) {
+              close(writers[s]);
+              remaining--;
+            }
+          }
+        }
+      });
+
+      auto start = std::chrono::steady_clock::now();
+      pipeline.run();
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+      feeder.join();
+
+      std::uint64_t samples = 0;
+      std::uint64_t waits = 0;
+      std::size_t mismatched = 0;
+      for (std::size_t s = 0; s < streams; s++) {
+        const SocketPipeline::StreamStats& stats = pipeline.getStats(s);
+        samples += stats.samples;
+        waits += stats.waits;
+        mismatched += received[s] != expected[s] || stats.error != 0;
+      }
+
+      std::cout << std::endl;
+      std::cout << "Streams: " << streams << ", samples: " << samples
+                << ", waits for data: " << waits << std::endl;
+      std::cout << "Throughput (one thread, feeder on another): "
+                << samples / elapsed.count() / 1e6 << " M samples/s, "
+                << samples / elapsed.count() / streams
+                << " samples/s per stream" << std::endl;
+      std::cout << "episodes match direct detection: "
+                << (mismatched == 0 ? "yes"
+                    : "NO (" + std::to_string(mismatched) + " streams)")
+                << std::endl;
+      std::cout << std::endl;
+      return mismatched == 0 ? 0 : 1;
+    } catch (const std::exception& error) {
+      std::cerr << error.what() << std::endl;
+      return 1;
+    }
+}
+
+// Writes count random samples in the replay file format, so
+// there is something to replay.
+// Usage: AnomalyDetector capture <file> <count> [raw|varint]
+int runCapture(int argc, char* argv[]) {
+    std::string format = argc > 4 ? argv[4] : "raw";
+    if (argc < 4 || (format != "raw" && format != "varint")) {
+      std::cerr << "usage: AnomalyDetector capture <file> <count> [raw|varint]"
+                << std::endl;
+      return 2;
+    }
+    std::uint64_t count = 0;
+    if (!readArgument(argc, argv, 3, "count", 0, UINT64_MAX, count)) return 2;
+    bool varint = format == "varint";
+
+    std::ofstream out(argv[2], std::ios::binary);
+    if (!out) {
+      std::cerr << "cannot open " << argv[2] << " for writing" << std::endl;
+      return 1;
+    }
+
+    unsigned int seed = defaults::use_time_seed ? time(0) : defaults::set_seed;
+    seedRandom(seed);
+
+    std::vector<int> samples;
+    std::vector<unsigned char> encoded;
+    int previous = 0;
+    const std::uint64_t chunk = 1 << 16;
+    for (std::uint64_t written = 0; written < count; written += chunk) {
+      samples.resize(std::min(chunk, count - written));
+      randomStream.fill(samples);
+      if (varint) {
+        encoded.clear();
+        for (int value : samples) varint_delta::encode(value, previous, encoded);
+        out.write((const char*)encoded.data(), encoded.size());
+      } else {
+        out.write((const char*)samples.data(), samples.size() * sizeof(int));
+      }
+    }
+    std::cout << "Random seed used: " << seed << std::endl;
+    return out ? 0 : 1;
+}
+
+// Replays a captured file (see ReplayFile.hpp) through a detector and prints
+// every alarm episode (sample numbers from 0) plus the replay throughput. Raw
+// files are fed straight from the mapping, varint files are decoded a block
+// at a time.
+// Usage: AnomalyDetector replay <file> [raw|varint]
+int runReplay(int argc, char* argv[]) {
+    std::string format = argc > 3 ? argv[3] : "raw";
+    if (argc < 3 || (format != "raw" && format != "varint")) {
+      std::cerr << "usage: AnomalyDetector replay <file> [raw|varint] "
+                << "[checkpoint]" << std::endl;
+      return 2;
+    }
+    bool varint = format == "varint";
+    // Note: with a checkpoint file the detector resumes from it (if it
+    // exists) and saves its state there afterwards, so consecutive captures
+    // replay as one stream without a warmup window in between.
+    std::string checkpointPath = argc > 4 ? argv[4] : "";
+
+    try {
+      MappedFile file(argv[2]);
+      RingAnomalyDetector detector = RingAnomalyDetector();
+      if (!checkpointPath.empty() && std::filesystem::exists(checkpointPath)) {
+        checkpoint::restore(checkpointPath, detector);
+        std::cout << "Resumed after sample "
+                  << detector.getSamplesConsumed() << std::endl;
+      }
+      std::uint64_t samples = 0;
+      std::uint64_t episodes = 0;
+      std::uint64_t alarmSamples = 0;
+      auto report = [&](const AlarmEpisode& episode) {
+        std::cout << "alarm from sample " << episode.start << " to "
+                  << episode.end << " (min peaks " << episode.minPeakCount
+                  << ")" << std::endl;
+        episodes++;
+        alarmSamples += episode.end - episode.start;
+      };
+
+      auto start = std::chrono::steady_clock::now();
+      if (varint) {
+        varint_delta::Decoder decoder(file.bytes());
+        std::vector<int> block(1 << 16);
+        while (std::size_t count = decoder.decode(block)) {
+          detector.scanBatch(std::span<const int>(block.data(), count),
+                             report);
+          samples += count;
+        }
+      } else {
+        detector.scanBatch(file.samples(), report);
+        samples = file.samples().size();
+      }
+      AlarmEpisode openEpisode;
+      if (detector.getOpenEpisode(openEpisode)) report(openEpisode);
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+      if (!checkpointPath.empty()) checkpoint::save(checkpointPath, detector);
+
+      std::cout << std::endl;
+      std::cout << "Samples replayed: " << samples << std::endl;
+      std::cout << "Alarm episodes: " << episodes << ", samples in alarm: "
+                << alarmSamples << std::endl;
+      std::cout << "Throughput: " << samples / elapsed.count() / 1e6
+                << " M samples/s" << std::endl;
+    } catch (const std::exception& error) {
+      std::cerr << error.what() << std::endl;
+      return 1;
+    }
+    return 0;
+}
+
+// Detects on delimited integers read from stdin, which can be a file or a
+// pipe, e.g. `seq 1 1000000 | AnomalyDetector stdin`. Blocks of parsed
+// samples go straight to scanBatch and alarm episodes are printed as in
+// replay.
+// Usage: AnomalyDetector stdin [window size] [alarm percentage]
+int runStdin(int argc, char* argv[]) {
+    unsigned int windowSize = defaults::window_size;
+    unsigned int alarmPercentage = defaults::alarm_percentage;
+    if (!readArgument(argc, argv, 2, "window size", 1, UINT_MAX,
+                      windowSize) ||
+        !readArgument(argc, argv, 3, "alarm percentage", 0, 100,
+                      alarmPercentage)) {
+      std::cerr << "usage: AnomalyDetector stdin [window size] "
+                << "[alarm percentage]" << std::endl;
+      return 2;
+    }
+
+    try {
+      text_input::IntegerReader reader(STDIN_FILENO);
+      RingAnomalyDetector detector(windowSize, alarmPercentage);
+      std::uint64_t samples = 0;
+      std::uint64_t episodes = 0;
+      auto report = [&](const AlarmEpisode& episode) {
+        std::cout << "alarm from sample " << episode.start << " to "
+                  << episode.end << " (min peaks " << episode.minPeakCount
+                  << ")" << std::endl;
+        episodes++;
+      };
+
+      auto start = std::chrono::steady_clock::now();
+      std::vector<int> block(1 << 16);
+      while (std::size_t count = reader.read(block)) {
+        detector.scanBatch(std::span<const int>(block.data(), count), report);
+        samples += count;
+      }
+      AlarmEpisode openEpisode;
+      if (detector.getOpenEpisode(openEpisode)) report(openEpisode);
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+      std::cout << std::endl;
+      std::cout << "Samples read: " << samples << ", rejected tokens: "
+                << reader.getRejected() << std::endl;
+      std::cout << "Alarm episodes: " << episodes << std::endl;
+      std::cout << "Throughput: " << samples / elapsed.count() / 1e6
+                << " M samples/s, "
+                << reader.getBytesRead() / elapsed.count() / 1e6 << " MB/s"
+                << std::endl;
+    } catch (const std::exception& error) {
+      std::cerr << error.what() << std::endl;
+      return 1;
+    }
+    return 0;
+}
+
+int runMode(int argc, char* argv[]) {
+    // Note: the first argument picks a mode, with no arguments we run the
+    // original single detector test below.
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "sharded") return runSharded(argc, argv);
+    if (mode == "pipeline") return runPipeline(argc, argv);
+    if (mode == "sockets") return runSockets(argc, argv);
+    if (mode == "capture") return runCapture(argc, argv);
+    if (mode == "replay") return runReplay(argc, argv);
+    if (mode == "stdin") return runStdin(argc, argv);
+
     // getting random seed from time or from given
     // Note: If this were a proper production testing environment we would want
     // to print the seed to some sort of log file. It also may make sense to
@@ -169,7 +540,7 @@ int main() {
     unsigned int seed = defaults::use_time_seed ? time(0) : defaults::set_seed;
     // To intern: We would benefit from a different random number everytime and
     // to ensure reproducability we also should be setting + recording the seed
-    srand(seed);
+    seedRandom(seed);
     
     AnomalyDetector detector = AnomalyDetector();
 
@@ -187,15 +558,40 @@ int main() {
     
     // To intnrn: it is unlikely, but if overflow occurs we want
     // a different message to be printed
+    // Note: the limit is the detector's counter type's, 2^64 - 1 by default
     std::cout << std::endl;
     std::cout << "Random seed used: " << seed << std::endl;
     std::cout << "Anomaly detected after "
               << (detector.getOverflowOccured()
-                ? std::to_string(UINT_MAX) + "+"
+                ? std::to_string(std::numeric_limits<
+                    decltype(detector.getDatumNum())>::max()) + "+"
                 : std::to_string(detector.getDatumNum()))
               << " data points." << std::endl;
     std::cout << std::endl;
     return 0;
 }
 
+// Note: a trailing --stats (or --stats=json) prints the instrumentation
+// report once the mode has finished. The counters only exist in builds
+// configured with -DANOMALY_DETECTOR_INSTRUMENT=ON.
+int main(int argc, char* argv[]) {
+    std::string stats = argc > 1 ? argv[argc - 1] : "";
+    bool printStats = stats == "--stats" || stats == "--stats=json";
+    if (printStats) argc--;
+
+    int status = runMode(argc, argv);
+
+    if (printStats) {
+      if (!instrumentation::enabled) {
+        std::cerr << "instrumentation is not compiled in, configure with "
+                  << "-DANOMALY_DETECTOR_INSTRUMENT=ON" << std::endl;
+      } else if (stats == "--stats=json") {
+        instrumentation::writeJson(std::cout, instrumentation::snapshot());
+      } else {
+        instrumentation::writeText(std::cout, instrumentation::snapshot());
+      }
+    }
+    return status;
+}
+
 // NOTE: README.md contains summary docs
\ No newline at end of file
@@ -0,0 +1,1119 @@
+// NOTE: README.md contains summary docs
+
+// Tests for the detectors, built as AnomalyDetector_tests and run by ctest.
+// Usage: AnomalyDetector_tests
+//
+// One set of cases is run against every detector that implements the
+// default 100 sample, 25% configuration: AnomalyDetector, RingAnomalyDetector
+// and StaticAnomalyDetector<100, 25>. Each case is a short stream with the
+// sample the alarm first goes on worked out by hand, and every sample of it
+// is also checked against a naive recount of the window, per sample, by
+// processBatch stops and by scanBatch episodes. Regression checks for other
+// parts follow the suite.
+// To intern: the run carries on after a failed check and exits non-zero at
+// the end, so one bad change shows everything it broke. Longer randomised
+// comparisons live in AnomalyDetector_fuzz.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AnomalyDetector.hpp"
+#include "AnomalyDetectorBank.hpp"
+#include "Checkpoint.hpp"
+#include "CommandLine.hpp"
+#include "FusedDetector.hpp"
+#include "PeakHistory.hpp"
+#include "ReorderBuffer.hpp"
+#include "ReplayFile.hpp"
+#include "SocketPipeline.hpp"
+#include "SpscRingBuffer.hpp"
+#include "StreamGenerator.hpp"
+#include "TextInput.hpp"
+#include "TimeWindowDetector.hpp"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace tests
+{
+    static const unsigned int window_size = 100;
+    static const unsigned int alarm_percentage = 25;
+    static const std::size_t random_size = 20000;
+    static const std::size_t long_size = 1 << 16;
+    static const int fused_trials = 50;
+
+    unsigned int checks = 0;
+    unsigned int failures = 0;
+
+    void expect(bool condition, const std::string& what) {
+      checks++;
+      if (condition) return;
+      failures++;
+      std::cerr << "FAILED: " << what << std::endl;
+    }
+
+    struct Case {
+      std::string name;
+      std::vector<int> data;
+      // the first sample after which the alarm is on (data.size() if never),
+      // worked out by hand; not given for the random streams
+      std::optional<std::size_t> firstAlarm;
+    };
+
+    // The alarm state after every sample, from the definition: the window is
+    // the last window_size samples, sample i confirms a peak when sample
+    // i - 1 is higher than both of its neighbours, and the alarm is on once
+    // the window has filled with fewer than alarm_percentage percent peaks.
+    struct Reference {
+      std::vector<bool> alarms;
+      std::vector<AlarmEpisode> episodes; // the last one may still be open
+    };
+
+    Reference reference(const std::vector<int>& data) {
+      std::size_t n = data.size();
+      Reference result;
+      std::vector<std::size_t> counts(n, 0);
+      for (std::size_t i = 0; i < n; i++) {
+        std::size_t first = i + 1 >= window_size ? i + 1 - window_size : 0;
+        for (std::size_t j = std::max<std::size_t>(first, 2); j <= i; j++) {
+          counts[i] += data[j - 1] > data[j - 2] && data[j - 1] > data[j];
+        }
+        result.alarms.push_back(i + 1 >= window_size &&
+          counts[i] * 100 < window_size * alarm_percentage);
+      }
+      for (std::size_t i = 0; i < n; i++) {
+        if (!result.alarms[i]) continue;
+        if (i == 0 || !result.alarms[i - 1]) {
+          result.episodes.push_back(AlarmEpisode{i, n, counts[i]});
+        }
+        AlarmEpisode& episode = result.episodes.back();
+        episode.minPeakCount = std::min(episode.minPeakCount, counts[i]);
+        if (i + 1 < n && !result.alarms[i + 1]) episode.end = i + 1;
+      }
+      return result;
+    }
+
+    std::vector<int> repeat(std::vector<int> pattern, std::size_t size) {
+      std::vector<int> data(size);
+      for (std::size_t i = 0; i < size; i++) {
+        data[i] = pattern[i % pattern.size()];
+      }
+      return data;
+    }
+
+    std::vector<Case> makeCases() {
+      std::vector<Case> cases;
+      // no peaks at all: on as soon as the window has filled
+      cases.push_back({"flat", repeat({5}, 300), 99});
+      cases.push_back({"rising", repeat({0}, 300), 99});
+      for (std::size_t i = 0; i < 300; i++) cases.back().data[i] = i;
+      cases.push_back({"short", repeat({5}, 99), 99});
+      // one peak every 2 samples (50%), with negative and extreme values
+      cases.push_back({"alternating", repeat({0, 1}, 300), 300});
+      cases.push_back({"negative", repeat({-100, -1}, 300), 300});
+      cases.push_back({"extremes", repeat({INT_MIN, INT_MAX}, 300), 300});
+      // exactly 25 peaks in every window is not fewer than 25%
+      cases.push_back({"quarter", repeat({0, 1, 0, 0}, 400), 400});
+      // ... but one missing peak (confirmed at 202) is, for the 100 windows
+      // that would have held it
+      cases.push_back({"quarter_gap", repeat({0, 1, 0, 0}, 400), 202});
+      cases.back().data[201] = 0;
+      // main.cpp's fakeStreamList: 12 peaks, then a plateau
+      cases.push_back({"fake_stream_list", repeat({3}, 200), 99});
+      for (std::size_t i = 0; i < 26; i++) cases.back().data[i] = 1 - i % 2;
+
+      StreamGenerator healthy(1);
+      StreamGenerator degraded(2, Regime::degraded());
+      StreamGenerator switching(3, Regime::healthy(), Regime::degraded(),
+                                0.001, 0.001);
+      for (auto [name, generator] :
+           {std::pair{"healthy", &healthy}, std::pair{"degraded", &degraded},
+            std::pair{"switching", &switching}}) {
+        cases.push_back({name, std::vector<int>(random_size), std::nullopt});
+        generator->fill(0, cases.back().data);
+      }
+      return cases;
+    }
+
+    // Runs every case through fresh detectors from make(): per sample, by
+    // processBatch from every stop, and by scanBatch in packets of 37.
+    template <typename Make>
+    void runSuite(const std::string& variant, const std::vector<Case>& cases,
+                  Make make) {
+      for (const Case& c : cases) {
+        std::string name = variant + "/" + c.name;
+        Reference expected = reference(c.data);
+        std::span<const int> data(c.data);
+
+        if (c.firstAlarm) {
+          std::size_t first = 0;
+          while (first < data.size() && !expected.alarms[first]) first++;
+          expect(first == *c.firstAlarm, name + ": reference disagrees with "
+                 "the hand worked first alarm");
+        }
+
+        auto perSample = make();
+        for (std::size_t i = 0; i < data.size(); i++) {
+          perSample.processNewDataPoint(data[i]);
+          if (perSample.getAlarmActive() != expected.alarms[i]) {
+            expect(false, name + ": wrong alarm state after sample " +
+                   std::to_string(i));
+            break;
+          }
+        }
+
+        auto batched = make();
+        std::size_t position = 0;
+        while (position < data.size()) {
+          std::size_t stop = batched.processBatch(data.subspan(position));
+          std::size_t want = 0;
+          while (position + want < data.size() &&
+                 !expected.alarms[position + want]) {
+            want++;
+          }
+          if (stop != want) {
+            expect(false, name + ": processBatch from sample " +
+                   std::to_string(position) + " stopped at " +
+                   std::to_string(position + stop));
+            break;
+          }
+          if (position == 0 && c.firstAlarm) {
+            expect(stop == *c.firstAlarm, name + ": first processBatch stop");
+          }
+          position += stop + 1;
+        }
+
+        auto scanned = make();
+        std::vector<AlarmEpisode> episodes;
+        for (std::size_t at = 0; at < data.size(); at += 37) {
+          scanned.scanBatch(data.subspan(at, std::min<std::size_t>(
+            37, data.size() - at)), [&](const AlarmEpisode& episode) {
+            episodes.push_back(episode);
+          });
+        }
+        AlarmEpisode open;
+        if (scanned.getOpenEpisode(open)) episodes.push_back(open);
+        expect(episodes == expected.episodes, name + ": scanBatch episodes");
+      }
+    }
+
+    // Generated streams long enough for windows of 10,000: healthy,
+    // degraded, and switching between the two every few thousand samples.
+    std::vector<std::pair<std::string, std::vector<int>>> longStreams() {
+      StreamGenerator healthy(4);
+      StreamGenerator degraded(5, Regime::degraded());
+      StreamGenerator switching(6, Regime::healthy(), Regime::degraded(),
+                                0.0002, 0.0002);
+      std::vector<std::pair<std::string, std::vector<int>>> streams;
+      for (auto [name, generator] :
+           {std::pair{"healthy", &healthy}, std::pair{"degraded", &degraded},
+            std::pair{"switching", &switching}}) {
+        streams.emplace_back(name, std::vector<int>(long_size));
+        generator->fill(0, streams.back().second);
+      }
+      return streams;
+    }
+
+    // The batch calls with slack skipping (the default) against the exact
+    // per-sample path, for both runtime configured detectors: the same stop
+    // for every packet, the same state after it and the same episodes.
+    template <typename Detector>
+    void checkSlackSkipping(const std::string& variant,
+                            const std::vector<Case>& cases) {
+      const std::size_t packets[] = {1, 7, 64, 1000, 4096};
+      std::vector<std::pair<std::string, std::vector<int>>> streams =
+        longStreams();
+      for (const Case& c : cases) streams.emplace_back(c.name, c.data);
+
+      for (const auto& [shape, stream] : streams) {
+        for (unsigned int window : {1u, 2u, 100u, 1000u, 10000u}) {
+          for (unsigned int percentage : {0u, 25u, 33u, 50u, 100u}) {
+            std::string name = "slack/" + variant + "/" + shape + "/" +
+              std::to_string(window) + "/" + std::to_string(percentage);
+            Detector slack(window, percentage);
+            Detector exact(window, percentage);
+            exact.setSlackSkipping(false);
+            std::span<const int> data(stream);
+            bool same = true;
+            for (std::size_t position = 0, packet = 0;
+                 position < data.size() && same; packet++) {
+              std::span<const int> part = data.subspan(position,
+                std::min(packets[packet % 5], data.size() - position));
+              std::size_t stop = slack.processBatch(part);
+              same = stop == exact.processBatch(part) &&
+                     slack.getAlarmActive() == exact.getAlarmActive() &&
+                     slack.getSamplesConsumed() == exact.getSamplesConsumed();
+              position += stop < part.size() ? stop + 1 : part.size();
+            }
+            expect(same, name + ": processBatch stops differ from the "
+                   "exact path");
+
+            Detector slackScan(window, percentage);
+            Detector exactScan(window, percentage);
+            exactScan.setSlackSkipping(false);
+            expect(slackScan.scanBatch(data) == exactScan.scanBatch(data),
+                   name + ": scanBatch episodes differ from the exact path");
+          }
+        }
+      }
+    }
+
+    // FusedAnomalyDetector against AnomalyDetector on its exact per-sample
+    // path, over random window sizes, percentages and stretches of every
+    // stream, fed as packets of random size mixed with single samples, and
+    // every fourth trial one sample at a time: the same stop for every packet
+    // and the same state after every call.
+    void checkFusedDetector(const std::vector<Case>& cases) {
+      std::mt19937 random(20);
+      auto pick = [&](std::size_t bound) {return random() % bound;};
+      std::vector<std::pair<std::string, std::vector<int>>> streams =
+        longStreams();
+      for (const Case& c : cases) streams.emplace_back(c.name, c.data);
+
+      for (const auto& [shape, stream] : streams) {
+        std::span<const int> data(stream);
+        for (int trial = 0; trial < fused_trials; trial++) {
+          unsigned int window = 1 + pick(trial % 2 ? 2000 : 130);
+          unsigned int percentage = pick(101);
+          std::string name = "fused/" + shape + "/" +
+            std::to_string(window) + "/" + std::to_string(percentage);
+          AnomalyDetector exact(window, percentage);
+          exact.setSlackSkipping(false);
+          FusedAnomalyDetector fused(window, percentage);
+          std::size_t position = pick(data.size() / 2 + 1);
+          std::size_t end =
+            std::min(data.size(), position + 20000 + pick(20000));
+          bool same = true;
+          while (position < end && same) {
+            std::size_t length = 1;
+            if (trial % 4 == 3 || pick(4) == 0) {
+              exact.processNewDataPoint(data[position]);
+              fused.processNewDataPoint(data[position]);
+            } else {
+              length = std::min<std::size_t>(1 + pick(1000), end - position);
+              std::span<const int> part = data.subspan(position, length);
+              std::size_t stop = fused.processBatch(part);
+              same = stop == exact.processBatch(part);
+              if (stop < length) length = stop + 1;
+            }
+            same = same &&
+                   exact.getAlarmActive() == fused.getAlarmActive() &&
+                   exact.getSamplesConsumed() == fused.getSamplesConsumed();
+            position += length;
+          }
+          expect(same, name + ": differs from AnomalyDetector at sample " +
+                 std::to_string(position));
+        }
+      }
+    }
+
+    // Sends all of data to a socket, false if it could not.
+    bool sendAll(int descriptor, const std::vector<int>& data) {
+      const char* bytes = reinterpret_cast<const char*>(data.data());
+      std::size_t size = data.size() * sizeof(int);
+      for (std::size_t done = 0; done < size;) {
+        ssize_t sent = send(descriptor, bytes + done, size - done,
+                            MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        done += sent;
+      }
+      return true;
+    }
+
+    // SocketPipeline: onEpisode throws for stream 0 while streams 1-3 wait
+    // for data inside their coroutines, then 20 more streams are added
+    // before run() is called again. The waiting coroutines hold on to their
+    // channel across co_await, so adding streams must not move channels
+    // (this was a use after free with a vector of channels, seen with ASan).
+    void checkSocketPipelineAfterException() {
+      const std::size_t first_streams = 4;
+      const std::size_t added_streams = 20;
+      std::vector<int> flat = repeat({5}, 1000);
+      std::vector<int> writers;
+      SocketPipeline pipeline(
+        [](SocketPipeline::Stream stream, const AlarmEpisode&) {
+          if (stream == 0) throw std::runtime_error("episode on stream 0");
+        }, 16);
+      auto addStream = [&] {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) return false;
+        pipeline.addStream(pair[0]);
+        writers.push_back(pair[1]);
+        return true;
+      };
+
+      // stream 0 yields every 16 reads of 16 samples, so streams 1-3 have
+      // read their first part and are waiting when its episode comes out
+      bool ready = true;
+      for (std::size_t s = 0; s < first_streams; s++) ready &= addStream();
+      ready = ready && sendAll(writers[0], flat);
+      close(writers[0]);
+      for (std::size_t s = 1; s < first_streams; s++) {
+        ready = ready && sendAll(writers[s], repeat({0, 1}, 100));
+      }
+      expect(ready, "pipeline: set up the first streams");
+      if (!ready) return;
+      bool threw = false;
+      try {
+        pipeline.run();
+      } catch (const std::runtime_error&) {
+        threw = true;
+      }
+      expect(threw, "pipeline: run() rethrows the exception from onEpisode");
+      expect(pipeline.getStats(0).finished,
+             "pipeline: the stream that threw is finished");
+
+      for (std::size_t s = 0; s < added_streams; s++) ready &= addStream();
+      for (std::size_t s = 1; s < writers.size(); s++) {
+        ready = ready && sendAll(writers[s], flat);
+        close(writers[s]);
+      }
+      expect(ready, "pipeline: set up the added streams");
+      if (!ready) return;
+      pipeline.run();
+      expect(pipeline.activeStreams() == 0, "pipeline: every stream ended");
+      for (std::size_t s = 1; s < writers.size(); s++) {
+        std::uint64_t samples = s < first_streams ? 1100 : 1000;
+        expect(pipeline.getStats(s).samples == samples &&
+               pipeline.getStats(s).episodes == 1,
+               "pipeline: stream " + std::to_string(s) + " read everything");
+      }
+    }
+
+    // Whether f() throws an Exception.
+    template <typename Exception, typename F>
+    bool throws(F&& f) {
+      try {
+        f();
+      } catch (const Exception&) {
+        return true;
+      }
+      return false;
+    }
+
+    // TimeWindowAnomalyDetector against a naive timestamped model. A sample
+    // belongs to the bucket of the newest timestamp so far (a late sample is
+    // counted in the newest bucket), the window after sample i is every
+    // sample whose bucket is within bucketCount buckets of sample i's, and
+    // the alarm needs a full window of time since the first sample. The
+    // streams mix many samples per bucket, steps of a few buckets and gaps
+    // longer than the window, checked per sample and by processBatch stops.
+    void checkTimeWindow() {
+      const std::uint64_t bucket_ns = 10;
+      std::mt19937 random(7);
+      auto pick = [&](std::uint64_t bound) {return random() % bound;};
+
+      for (int trial = 0; trial < 40; trial++) {
+        std::uint64_t buckets = 1 + pick(trial % 2 ? 8 : 200);
+        std::uint64_t windowNs = buckets * bucket_ns - pick(bucket_ns);
+        unsigned int percentage = pick(60);
+        std::string name = "time_window/" + std::to_string(buckets) + "/" +
+          std::to_string(percentage);
+        std::size_t n = 5000;
+        std::vector<int> data(n);
+        std::vector<std::uint64_t> timestamps(n);
+        std::uint64_t now = 1000 + pick(1000);
+        for (std::size_t i = 0; i < n; i++) {
+          // half stay in the same bucket, the rest step a few buckets, up
+          // to a window, or one to three whole windows
+          std::uint64_t step = pick(20);
+          if (step >= 10 && step < 17) now += pick(3 * bucket_ns);
+          if (step >= 17 && step < 19) now += pick(buckets * bucket_ns);
+          if (step == 19) now += buckets * bucket_ns * (1 + pick(3));
+          timestamps[i] = pick(50) == 0 && now > 25 ? now - pick(25) : now;
+          data[i] = pick(trial % 3 == 0 ? 3 : 100);
+        }
+
+        std::vector<bool> alarms(n);
+        std::vector<std::uint64_t> inWindow(n), peaksInWindow(n);
+        std::vector<std::uint64_t> bucketOf(n);
+        std::uint64_t newest = 0;
+        for (std::size_t i = 0; i < n; i++) {
+          newest = std::max(newest, timestamps[i] / bucket_ns);
+          bucketOf[i] = newest;
+          for (std::size_t j = 0; j <= i; j++) {
+            if (bucketOf[j] + buckets <= bucketOf[i]) continue;
+            inWindow[i]++;
+            peaksInWindow[i] += j >= 2 && data[j - 1] > data[j - 2] &&
+                                data[j - 1] > data[j];
+          }
+          alarms[i] = timestamps[i] >= timestamps[0] + buckets * bucket_ns &&
+            peaksInWindow[i] * 100 < inWindow[i] * percentage;
+        }
+
+        TimeWindowAnomalyDetector perSample(windowNs, percentage, bucket_ns);
+        for (std::size_t i = 0; i < n; i++) {
+          perSample.processNewDataPoint(data[i], timestamps[i]);
+          if (perSample.getAlarmActive() != alarms[i] ||
+              perSample.getSamplesInWindow() != inWindow[i] ||
+              perSample.getPeaksInWindow() != peaksInWindow[i]) {
+            expect(false, name + ": wrong window after sample " +
+                   std::to_string(i));
+            break;
+          }
+        }
+
+        TimeWindowAnomalyDetector batched(windowNs, percentage, bucket_ns);
+        std::span<const int> samples(data);
+        std::span<const std::uint64_t> times(timestamps);
+        for (std::size_t position = 0; position < n;) {
+          std::size_t length = std::min<std::size_t>(1 + pick(700),
+                                                     n - position);
+          std::size_t stop = batched.processBatch(
+            samples.subspan(position, length),
+            times.subspan(position, length));
+          std::size_t want = 0;
+          while (want < length && !alarms[position + want]) want++;
+          if (stop != want) {
+            expect(false, name + ": processBatch from sample " +
+                   std::to_string(position) + " stopped at " +
+                   std::to_string(position + stop));
+            break;
+          }
+          position += stop < length ? stop + 1 : length;
+        }
+      }
+
+      expect(throws<std::invalid_argument>([] {
+        TimeWindowAnomalyDetector detector(100, 25, 0);
+      }), "time_window: a bucket size of 0 is rejected");
+      TimeWindowAnomalyDetector detector(100, 25, 10);
+      std::vector<int> data(8, 1);
+      std::vector<std::uint64_t> timestamps(7, 0);
+      expect(throws<std::invalid_argument>([&] {
+        detector.processBatch(data, timestamps);
+      }) && detector.getDatumNum() == 0,
+             "time_window: a batch short of timestamps is rejected");
+    }
+
+    // FNV-1a over the samples, to pin a stream down in one number.
+    std::uint64_t fingerprint(std::span<const int> data) {
+      std::uint64_t hash = 14695981039346656037ull;
+      for (int value : data) {
+        hash = (hash ^ (std::uint32_t)value) * 1099511628211ull;
+      }
+      return hash;
+    }
+
+    // StreamGenerator: Philox4x32-10 against the published known-answer
+    // vectors (Random123's kat_vectors), the vectorised philox::fill against
+    // generate() (including counters whose low word wraps), every way of
+    // reaching a segment against one sequential fill, and fingerprints of
+    // the first samples of two seeds, so a refactor of the generator cannot
+    // change the streams without failing here.
+    void checkStreamGenerator() {
+      const std::array<std::array<std::uint32_t, 10>, 3> known = {{
+        {0, 0, 0, 0, 0, 0,
+         0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+        {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+         0xffffffff, 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+        {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822,
+         0x299f31d0, 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1},
+      }};
+      for (const auto& v : known) {
+        auto words = philox::rounds({v[0], v[1], v[2], v[3]}, {v[4], v[5]});
+        expect(words == std::array<std::uint32_t, 4>{v[6], v[7], v[8], v[9]},
+               "philox: known-answer vector " + std::to_string(v[6]));
+      }
+      expect(philox::generate(0, 0, 0) ==
+               std::array<std::uint32_t, 4>{known[0][6], known[0][7],
+                                            known[0][8], known[0][9]},
+             "philox: generate() puts the counter in words 0-1");
+
+      for (std::uint64_t first : {0ull, 5ull, 0xfffffff9ull, 0x1fffffffcull}) {
+        for (std::size_t counters : {1u, 7u, 8u, 9u, 37u}) {
+          std::vector<std::uint32_t> words(counters * 4);
+          philox::fill(first, counters, 2, 0x123456789abcdefull,
+                       words.data());
+          bool same = true;
+          for (std::size_t c = 0; c < counters; c++) {
+            auto expected = philox::generate(first + c, 2,
+                                             0x123456789abcdefull);
+            same &= std::equal(expected.begin(), expected.end(),
+                               words.begin() + c * 4);
+          }
+          expect(same, "philox: fill from " + std::to_string(first) + " of " +
+                 std::to_string(counters) + " counters matches generate()");
+        }
+      }
+
+      StreamGenerator single(1);
+      StreamGenerator switching(3, Regime::healthy(), Regime::degraded(),
+                                0.001, 0.001);
+      for (auto [name, generator] : {std::pair{"single", &single},
+                                     std::pair{"switching", &switching}}) {
+        std::string prefix = std::string("generator/") + name;
+        const std::size_t size = 3 * StreamGenerator::epoch_size;
+        std::vector<int> whole(size);
+        generator->fill(0, whole);
+        std::span<const int> expected(whole);
+
+        std::vector<int> parallel(size);
+        generator->fillParallel(0, parallel, 3);
+        expect(parallel == whole, prefix + ": fillParallel matches fill");
+
+        // segments that start and end inside, on and across epochs
+        for (std::size_t offset : {std::size_t(1), std::size_t(1000),
+                                   StreamGenerator::epoch_size - 3,
+                                   StreamGenerator::epoch_size,
+                                   2 * StreamGenerator::epoch_size + 17}) {
+          std::vector<int> segment(std::min<std::size_t>(70000,
+                                                         size - offset));
+          generator->fill(offset, segment);
+          expect(std::equal(segment.begin(), segment.end(),
+                            expected.begin() + offset),
+                 prefix + ": fill from " + std::to_string(offset));
+
+          StreamCursor cursor(*generator, offset);
+          bool same = cursor.getOffset() == offset;
+          for (std::size_t i = 0; i < 5000 && same; i++) {
+            same = cursor.next() == whole[offset + i];
+          }
+          expect(same, prefix + ": cursor from " + std::to_string(offset));
+        }
+
+        // next() buffers ahead; fill() must hand out what it buffered first
+        std::mt19937 random(11);
+        StreamCursor cursor(*generator);
+        std::size_t at = 0;
+        bool same = true;
+        while (at < size - 3000 && same) {
+          same = cursor.getOffset() == at;
+          if (random() % 2) {
+            same = same && cursor.next() == whole[at++];
+          } else {
+            std::vector<int> part(random() % 3000);
+            cursor.fill(part);
+            same = same && std::equal(part.begin(), part.end(),
+                                      expected.begin() + at);
+            at += part.size();
+          }
+        }
+        expect(same, prefix + ": next() and fill() mixed on one cursor");
+      }
+
+      std::vector<int> first(1 << 17);
+      single.fill(0, first);
+      expect(fingerprint(first) == 0x36ddede064ed950full,
+             "generator: seed 1 stream changed");
+      switching.fill(0, first);
+      expect(fingerprint(first) == 0xcb255d6e02cd8bd8ull,
+             "generator: seed 3 switching stream changed");
+    }
+
+    // Restores window state whose peak count was tampered with (a flipped
+    // bit at byte `at` of the saved state); true if it was rejected.
+    template <typename Window>
+    bool rejectsFlippedBit(Window& window, std::size_t at) {
+      std::vector<unsigned char> state;
+      checkpoint::Writer writer(state);
+      window.saveState(writer);
+      state[at] ^= 1;
+      checkpoint::Reader reader(state);
+      return throws<std::runtime_error>([&] {window.restoreState(reader);});
+    }
+
+    // Checkpoints: a round trip carries on exactly like the original, a
+    // record saved from another type (same field sizes, int against float
+    // samples) or for another window size is rejected, and so is window
+    // state whose bits disagree with its peak count.
+    void checkCheckpoints() {
+      std::string path = (std::filesystem::temp_directory_path() /
+        ("AnomalyDetector_tests_" + std::to_string(getpid()) + ".ckpt"))
+        .string();
+      std::vector<int> data(20000);
+      StreamGenerator(8, Regime::degraded()).fill(0, data);
+      std::span<const int> first = std::span<const int>(data).first(10000);
+      std::span<const int> rest = std::span<const int>(data).subspan(10000);
+
+      RingAnomalyDetector original(window_size, alarm_percentage);
+      original.scanBatch(first);
+      checkpoint::save(path, original);
+      RingAnomalyDetector restored(window_size, alarm_percentage);
+      checkpoint::restore(path, restored);
+      expect(original.scanBatch(rest) == restored.scanBatch(rest) &&
+             original.getSamplesConsumed() == restored.getSamplesConsumed(),
+             "checkpoint: a restored detector carries on like the original");
+
+      TypedAnomalyDetector<std::int32_t> integral(window_size,
+                                                  alarm_percentage);
+      integral.scanBatch(first);
+      checkpoint::save(path, integral);
+      TypedAnomalyDetector<float> real(window_size, alarm_percentage);
+      expect(throws<std::runtime_error>([&] {checkpoint::restore(path, real);}),
+             "checkpoint: a record of another sample type is rejected");
+      RingAnomalyDetector larger(window_size + 1, alarm_percentage);
+      checkpoint::save(path, original);
+      expect(throws<std::runtime_error>([&] {
+        checkpoint::restore(path, larger);
+      }), "checkpoint: a record of another window size is rejected");
+      std::filesystem::remove(path);
+
+      // windowSize, position and peaks come before the bits of a ring
+      BitRingPeakWindow ring(window_size);
+      StaticPeakWindow<1000> staticRing;
+      StaticPeakWindow<100> shiftRegister;
+      for (std::size_t i = 0; i < 3000; i++) {
+        bool isPeak = data[i] % 3 == 0;
+        ring.slide(i, isPeak);
+        staticRing.slide(i, isPeak);
+        shiftRegister.slide(i, isPeak);
+      }
+      expect(rejectsFlippedBit(ring, 12),
+             "checkpoint: a ring whose bits disagree with its peaks");
+      expect(rejectsFlippedBit(ring, 12 + 15),
+             "checkpoint: a ring with bits set past its window");
+      expect(rejectsFlippedBit(staticRing, 8),
+             "checkpoint: a static ring whose bits disagree with its peaks");
+      expect(rejectsFlippedBit(shiftRegister, 0),
+             "checkpoint: a shift register whose bits disagree with its "
+             "peaks");
+    }
+
+    // What the text parser should make of text: the tokens between
+    // delimiters that std::from_chars reads as an int in full, with at most
+    // 10 digits (leading zeros included), and the number of other tokens.
+    // Tokens of at least tokenLimit bytes are rejected, like IntegerReader
+    // does with a token that fills its whole buffer.
+    std::pair<std::vector<int>, std::uint64_t> referenceParse(
+        const std::string& text,
+        std::size_t tokenLimit = std::string::npos) {
+      std::vector<int> values;
+      std::uint64_t rejected = 0;
+      std::size_t at = 0;
+      while (at < text.size()) {
+        if (text_input::isDelimiter(text[at])) {
+          at++;
+          continue;
+        }
+        std::size_t end = at;
+        while (end < text.size() && !text_input::isDelimiter(text[end])) end++;
+        int value = 0;
+        auto [stop, error] = std::from_chars(text.data() + at,
+                                             text.data() + end, value);
+        std::size_t digits = end - at - (text[at] == '-');
+        if (error == std::errc() && stop == text.data() + end &&
+            digits <= 10 && end - at < tokenLimit) {
+          values.push_back(value);
+        } else {
+          rejected++;
+        }
+        at = end;
+      }
+      return {values, rejected};
+    }
+
+    // Random delimited text: valid numbers of every length, the int limits
+    // and one past them, malformed tokens and runs of mixed delimiters.
+    std::string randomText(std::mt19937& random, std::size_t tokens) {
+      const char* delimiters = ", \t\r\n";
+      const char* odd[] = {"-", "+3", "12x", "x", "--1", "1-2", "-0",
+                           "007", "00000000001", "2147483647", "2147483648",
+                           "-2147483648", "-2147483649", "99999999999",
+                           "4294967296", "12345678901234567890", "3.5"};
+      std::string text;
+      for (std::size_t t = 0; t < tokens; t++) {
+        std::size_t run = random() % 8 == 0 ? 1 + random() % 6 : 1;
+        for (std::size_t d = 0; d < run; d++) {
+          text += delimiters[random() % 5];
+        }
+        unsigned int kind = random() % 10;
+        if (kind < 6) {
+          // numbers of 1 to 10 digits, either sign
+          int value = (int)random() >> (random() % 31);
+          text += std::to_string(value);
+        } else if (kind < 9) {
+          text += odd[random() % (sizeof(odd) / sizeof(odd[0]))];
+        } else {
+          text += std::string(1 + random() % 20, '0' + random() % 10);
+        }
+      }
+      if (random() % 2) text += '\n';
+      return text;
+    }
+
+    // The SIMD (SSE4.1/AVX2) or SWAR text parser and IntegerReader against
+    // std::from_chars: signs, overflow, runs of delimiters, tokens split
+    // across refills and overlong tokens, plus readArgument.
+    void checkTextInput() {
+      std::mt19937 random(16);
+      std::vector<std::string> texts = {"", ",,, \n", "-", "7", "-2147483648",
+                                        "2147483648\n-1,,2 ,3\r\n"};
+      for (int i = 0; i < 200; i++) texts.push_back(randomText(random, 300));
+
+      for (std::size_t t = 0; t < texts.size(); t++) {
+        const std::string& text = texts[t];
+        std::string name = "text_input/" + std::to_string(t);
+        auto [values, rejected] = referenceParse(text);
+
+        // parse() into a small out span, resuming where it stopped
+        std::vector<char> padded(text.begin(), text.end());
+        padded.resize(text.size() + text_input::padding, 'x');
+        const char* begin = padded.data();
+        const char* end = padded.data() + text.size();
+        std::vector<int> parsed;
+        std::uint64_t parsedRejected = 0;
+        while (begin < end) {
+          int out[7];
+          std::size_t count = text_input::parse(begin, end, out,
+                                                parsedRejected);
+          parsed.insert(parsed.end(), out, out + count);
+        }
+        expect(parsed == values && parsedRejected == rejected,
+               name + ": parse() differs from std::from_chars");
+
+        // IntegerReader from a file, with buffers from a few bytes (every
+        // token split across refills, long ones dropped) to the default
+        FILE* file = std::tmpfile();
+        if (!file) {
+          expect(false, name + ": cannot create a temporary file");
+          continue;
+        }
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fflush(file);
+        for (std::size_t block : {std::size_t(7), std::size_t(12),
+                                  std::size_t(64), std::size_t(1) << 20}) {
+          auto [blockValues, blockRejected] = referenceParse(text, block);
+          lseek(fileno(file), 0, SEEK_SET);
+          text_input::IntegerReader reader(fileno(file), block);
+          std::vector<int> read;
+          std::vector<int> out(1 + random() % 50);
+          while (std::size_t count = reader.read(out)) {
+            read.insert(read.end(), out.begin(), out.begin() + count);
+          }
+          expect(read == blockValues &&
+                 reader.getRejected() == blockRejected &&
+                 reader.getBytesRead() == text.size(),
+                 name + ": IntegerReader with " + std::to_string(block) +
+                 " byte blocks differs from std::from_chars");
+        }
+        std::fclose(file);
+      }
+
+      std::ostringstream errors;
+      auto argument = [&](const char* text, std::uint64_t minimum,
+                          std::uint64_t maximum, std::uint64_t& value) {
+        char program[] = "AnomalyDetector";
+        std::string copy = text;
+        char* argv[] = {program, copy.data(), nullptr};
+        return command_line::readArgument(2, argv, 1, "size", minimum,
+                                          maximum, value, errors);
+      };
+      std::uint64_t value = 42;
+      expect(argument("100", 1, 1000, value) && value == 100,
+             "readArgument: a number in range");
+      expect(argument("1", 1, 1, value) && value == 1,
+             "readArgument: both bounds are inclusive");
+      for (const char* bad : {"0", "1001", "-1", "12x", "x", "", "+5", " 5",
+                              "18446744073709551616"}) {
+        value = 42;
+        expect(!argument(bad, 1, 1000, value) && value == 42,
+               std::string("readArgument: rejects \"") + bad + "\"");
+      }
+      char program[] = "AnomalyDetector";
+      char* argv[] = {program, nullptr};
+      expect(command_line::readArgument(1, argv, 1, "size", 1, 10, value,
+                                        errors) && value == 42,
+             "readArgument: a missing argument keeps the default");
+    }
+
+    // PeakHistory's rank bitvector against a naive prefix sum, for
+    // recordings that start on and inside a chunk. The bits mix dense and
+    // sparse stretches with a whole chunk without peaks (whose bits are
+    // dropped), and are appended one at a time and as bitmap pieces. Ranges
+    // are random, end on chunk and 512 sample block boundaries, or start
+    // before the recording (which has to throw), before and after
+    // discarding old chunks.
+    void checkPeakHistory() {
+      const std::uint64_t chunk = 1 << 16;
+      std::mt19937_64 random(19);
+      for (std::uint64_t firstSample : {std::uint64_t(0), std::uint64_t(12345),
+                                        3 * chunk - 100}) {
+        std::string name = "peak_history/" + std::to_string(firstSample);
+        PeakHistory history(firstSample);
+        std::vector<std::uint64_t> prefix = {0}; // peaks before first + i
+        std::uint64_t total = 5 * chunk + 777;
+        while (prefix.size() - 1 < total) {
+          std::uint64_t sample = firstSample + prefix.size() - 1;
+          std::uint64_t stretch = sample / chunk % 4;
+          std::uint64_t word = stretch == 2 ? 0
+            : stretch == 1 ? random() & random() & random() : random();
+          std::size_t first = random() % 64;
+          std::size_t count = std::min<std::uint64_t>(
+            random() % 3 == 0 ? 1 : 1 + random() % (128 - first),
+            total - (prefix.size() - 1));
+          std::uint64_t bits[2] = {word, random()};
+          if (stretch == 2) bits[1] = 0;
+          if (count == 1 && random() % 2) {
+            history.append((bits[first / 64] >> (first % 64)) & 1);
+          } else {
+            history.append(bits, first, count);
+          }
+          for (std::size_t i = first; i < first + count; i++) {
+            prefix.push_back(prefix.back() + ((bits[i / 64] >> (i % 64)) & 1));
+          }
+        }
+
+        auto check = [&](std::uint64_t begin, std::uint64_t end) {
+          std::uint64_t expected = prefix[end - firstSample] -
+                                   prefix[begin - firstSample];
+          return history.peakCount(begin, end) == expected;
+        };
+        std::vector<std::uint64_t> edges = {firstSample, firstSample + 1,
+                                            history.getEnd() - 1,
+                                            history.getEnd()};
+        for (std::uint64_t at = chunk; at < history.getEnd(); at += 512) {
+          for (std::uint64_t edge : {at - 1, at, at + 1}) {
+            if (edge >= firstSample && edge <= history.getEnd()) {
+              edges.push_back(edge);
+            }
+          }
+        }
+        bool same = true;
+        for (std::size_t i = 0; i < 20000 && same; i++) {
+          std::uint64_t a = i < 10000
+            ? edges[random() % edges.size()]
+            : firstSample + random() % (total + 1);
+          std::uint64_t b = edges[random() % edges.size()];
+          same = check(std::min(a, b), std::max(a, b));
+        }
+        expect(same && history.peakCount(firstSample, firstSample) == 0 &&
+               history.peakPercentage(firstSample, firstSample) == 0,
+               name + ": range counts differ from the prefix sum");
+        if (firstSample > 0) {
+          expect(throws<std::out_of_range>([&] {
+            history.peakCount(firstSample - 1, firstSample + 10);
+          }), name + ": a range from before the recording is rejected");
+        }
+        expect(throws<std::out_of_range>([&] {
+          history.peakCount(firstSample, history.getEnd() + 1);
+        }), name + ": a range past the end is rejected");
+
+        // dropping old chunks keeps getFirst() on a chunk boundary (or the
+        // recording's start) and every range after it intact
+        history.discardBefore(firstSample + 2 * chunk + 5);
+        std::uint64_t kept = history.getFirst();
+        same = kept <= firstSample + 2 * chunk + 5 &&
+               (kept == firstSample || kept % chunk == 0);
+        for (std::size_t i = 0; i < 5000 && same; i++) {
+          std::uint64_t a = kept + random() % (history.getEnd() - kept + 1);
+          std::uint64_t b = kept + random() % (history.getEnd() - kept + 1);
+          same = check(std::min(a, b), std::max(a, b));
+        }
+        expect(same && throws<std::out_of_range>([&] {
+          history.peakCount(kept - 1, kept + 1);
+        }), name + ": ranges after discardBefore");
+      }
+    }
+
+    // varint_delta round trips: extreme values one after the other (deltas
+    // that wrap around, up to INT_MIN/INT_MAX themselves), small steps and
+    // random values, decoded in blocks of several sizes. A known encoding
+    // pins the format and a truncated last sample must be dropped.
+    void checkVarintDelta() {
+      std::vector<int> values = {0, INT_MIN, INT_MAX, INT_MIN, 0, INT_MAX,
+                                 -1, 0, 1, INT_MIN + 1, INT_MAX - 1, -1,
+                                 INT_MIN, -1, INT_MAX, 63, -64, 64, -65};
+      std::mt19937 random(8);
+      for (int i = 0; i < 10000; i++) {
+        int previous = values.back();
+        values.push_back(i % 3 == 0 ? previous + int(random() % 200) - 100
+                                    : int(random()));
+      }
+      std::vector<unsigned char> encoded;
+      int previous = 0;
+      for (int value : values) varint_delta::encode(value, previous, encoded);
+      expect(previous == values.back(), "varint_delta: encode tracks the "
+             "previous sample");
+
+      for (std::size_t blockSize : {1, 7, 4096, 1 << 16}) {
+        varint_delta::Decoder decoder(encoded);
+        std::vector<int> decoded;
+        std::vector<int> block(blockSize);
+        while (std::size_t count = decoder.decode(block)) {
+          decoded.insert(decoded.end(), block.begin(), block.begin() + count);
+        }
+        expect(decoded == values && decoder.bytesConsumed() == encoded.size(),
+               "varint_delta: round trip in blocks of " +
+               std::to_string(blockSize));
+      }
+
+      // INT_MIN from 0 is the largest zigzag value, INT_MAX back from there
+      // a delta of -1
+      std::vector<unsigned char> extremes;
+      previous = 0;
+      varint_delta::encode(INT_MIN, previous, extremes);
+      varint_delta::encode(INT_MAX, previous, extremes);
+      expect(extremes == std::vector<unsigned char>{0xff, 0xff, 0xff, 0xff,
+                                                    0x0f, 0x01},
+             "varint_delta: encoding of INT_MIN then INT_MAX");
+
+      std::vector<unsigned char> truncated(encoded.begin(),
+                                           encoded.begin() + 7);
+      truncated.push_back(0x80);
+      varint_delta::Decoder decoder(truncated);
+      std::vector<int> block(values.size());
+      std::size_t count = decoder.decode(block);
+      std::size_t whole = 0;
+      for (std::size_t i = 0; i < 7; i++) whole += !(encoded[i] & 0x80);
+      expect(count == whole &&
+             std::equal(block.begin(), block.begin() + count, values.begin()) &&
+             decoder.decode(block) == 0,
+             "varint_delta: a truncated last sample is dropped");
+    }
+
+    // processFrames rejects a trailing partial frame without consuming the
+    // whole frames before it.
+    void checkBankFrames() {
+      AnomalyDetectorBank bank(3, 4, 25);
+      std::vector<int> frames = {1, 2, 3, 4, 5, 6, 7};
+      expect(throws<std::invalid_argument>([&] {
+        bank.processFrames(frames);
+      }) && bank.getTicks() == 0, "bank: a partial frame is rejected");
+      frames.pop_back();
+      expect(bank.processFrames(frames) == 2 && bank.getTicks() == 2,
+             "bank: whole frames are consumed");
+    }
+
+    // SocketPipeline owns a descriptor from addStream on: a regular file,
+    // which epoll refuses to watch, is closed when addStream throws, and no
+    // stream is added.
+    void checkSocketPipelineRejectedStream() {
+      std::string path = (std::filesystem::temp_directory_path() /
+        ("AnomalyDetector_tests_" + std::to_string(getpid()) + ".file"))
+        .string();
+      int descriptor = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+      std::filesystem::remove(path);
+      expect(descriptor >= 0, "pipeline: open a regular file");
+      if (descriptor < 0) return;
+      SocketPipeline pipeline([](SocketPipeline::Stream,
+                                 const AlarmEpisode&) {}, 16);
+      expect(throws<std::runtime_error>([&] {
+        pipeline.addStream(descriptor);
+      }) && pipeline.activeStreams() == 0,
+             "pipeline: a file epoll cannot watch is rejected");
+      expect(fcntl(descriptor, F_GETFD) < 0 && errno == EBADF,
+             "pipeline: the rejected descriptor is closed");
+    }
+
+    // ReorderBuffer rejects a configuration without room or runs.
+    void checkReorderBufferConfig() {
+      expect(throws<std::invalid_argument>([] {
+        ReorderBuffer<int> buffer(0);
+      }) && throws<std::invalid_argument>([] {
+        ReorderBuffer<int> buffer(16, GapPolicy::wait, 0, 0);
+      }), "reorder buffer: a capacity or run size of 0 is rejected");
+    }
+
+    // SpscRingBuffer with a producer and a consumer thread: a counting
+    // sequence goes through a small ring (wrapping around many times) in
+    // writes and reads of random sizes, some larger than the ring, and has
+    // to come out complete and in order. A full ring has to stop the
+    // producer without losing samples.
+    void checkSpscRingBuffer() {
+      expect(SpscRingBuffer<int>(100).capacity() == 128 &&
+             SpscRingBuffer<int>(64).capacity() == 64,
+             "spsc: capacity is rounded up to a power of two");
+
+      const std::uint64_t total = 2'000'000;
+      SpscRingBuffer<std::uint64_t> queue(64);
+      // a broken ring can leave either side waiting for good, so the
+      // consumer gives up after a while and tells the producer to stop
+      std::atomic<bool> stop{false};
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::seconds(30);
+      auto waiting = [&] {
+        std::this_thread::yield();
+        return std::chrono::steady_clock::now() < deadline;
+      };
+      std::thread producer([&] {
+        std::mt19937 random(6);
+        for (std::uint64_t next = 0; next < total && !stop;) {
+          std::span<std::uint64_t> room = queue.acquireWrite(
+            std::min<std::uint64_t>(1 + random() % 100, total - next));
+          if (room.empty()) std::this_thread::yield();
+          for (std::uint64_t& slot : room) slot = next++;
+          queue.commitWrite(room.size());
+        }
+      });
+
+      std::mt19937 random(7);
+      std::uint64_t expected = 0;
+      bool inOrder = true;
+      bool bounded = true;
+      bool inTime = true;
+      while (expected < total && inOrder && inTime) {
+        // now and then let the ring fill up, so reads cross its end too
+        if (random() % 16 == 0) {
+          std::size_t full = std::min<std::uint64_t>(queue.capacity(),
+                                                     total - expected);
+          while (queue.size() < full && (inTime = waiting())) {}
+        }
+        bounded &= queue.size() <= queue.capacity();
+        std::span<const std::uint64_t> samples =
+          queue.acquireRead(1 + random() % 100);
+        if (samples.empty()) inTime = inTime && waiting();
+        for (std::uint64_t sample : samples) inOrder &= sample == expected++;
+        queue.release(samples.size());
+      }
+      stop = true;
+      producer.join();
+      expect(inTime, "spsc: the sequence got through within 30 s");
+      expect(inOrder && expected == total && queue.size() == 0 &&
+             queue.acquireRead(1).empty(),
+             "spsc: every sample arrives once and in order");
+      expect(bounded, "spsc: never holds more than its capacity");
+    }
+}
+
+int main() {
+    std::vector<tests::Case> cases = tests::makeCases();
+
+    tests::runSuite("deque", cases, [] {
+      return AnomalyDetector(tests::window_size, tests::alarm_percentage);
+    });
+    tests::runSuite("ring", cases, [] {
+      return RingAnomalyDetector(tests::window_size,
+                                 tests::alarm_percentage);
+    });
+    tests::runSuite("static", cases, [] {
+      return StaticAnomalyDetector<tests::window_size,
+                                   tests::alarm_percentage>();
+    });
+
+    tests::checkSlackSkipping<AnomalyDetector>("deque", cases);
+    tests::checkSlackSkipping<RingAnomalyDetector>("ring", cases);
+    tests::checkFusedDetector(cases);
+    tests::checkSocketPipelineAfterException();
+
+    tests::checkTimeWindow();
+    tests::checkStreamGenerator();
+    tests::checkCheckpoints();
+    tests::checkTextInput();
+    tests::checkPeakHistory();
+    tests::checkVarintDelta();
+    tests::checkBankFrames();
+    tests::checkSocketPipelineRejectedStream();
+    tests::checkReorderBufferConfig();
+    tests::checkSpscRingBuffer();
+    std::cout << tests::checks - tests::failures << " of " << tests::checks
+              << " checks passed" << std::endl;
+    return tests::failures == 0 ? 0 : 1;
+}